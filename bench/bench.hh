@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+/// Runs `fn` once to warm up and then `iterations` times,
+/// returning the mean wall time per iteration in nanoseconds.
+template <typename F> double time_ns(std::size_t iterations, F &&fn) {
+  fn();
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    fn();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         static_cast<double>(iterations);
+};
+
+inline void report(std::string_view name, double ns_per_iter) {
+  std::printf("  %-48.*s %14.1f us/iter\n", static_cast<int>(name.size()),
+              name.data(), ns_per_iter / 1000.0);
+};
+
+// Value below which `fraction` of `samples` fall. Sorts `samples`.
+inline double percentile(std::vector<double> &samples, double fraction) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  std::sort(samples.begin(), samples.end());
+  auto index = static_cast<std::size_t>(fraction * (samples.size() - 1));
+  return samples[index];
+};
+
+// Benchmark suites.
+void payload();
+void scheduling();
+void layout();
+void snapshot();
+void partition();
+void checkpoint();
+void memory();
+void edit();
+
+} // namespace bench
@@ -0,0 +1,66 @@
+#include "QGraph/qgraph.hh"
+#include "QGraph/qnode.hh"
+#include "bench.hh"
+#include <cstddef>
+#include <cstdio>
+
+// Full and incremental checkpoints of a large int graph, against
+// visiting every socket through the typed getters and setters.
+
+namespace {
+
+constexpr std::size_t num_nodes = 30000;
+constexpr std::size_t changed_nodes = num_nodes / 100;
+constexpr std::size_t iterations = 50;
+
+void build(qgraph::Graph &g) {
+  for (std::size_t i = 0; i < num_nodes; ++i) {
+    g.add_node<qgraph::MathNode>();
+  }
+};
+
+} // namespace
+
+void bench::checkpoint() {
+  qgraph::Graph g;
+  build(g);
+
+  std::vector<int> copy;
+  report("typed getters, 30k nodes", time_ns(iterations, [&] {
+           copy.clear();
+           for (qgraph::NodeId id = 0; id < num_nodes; ++id) {
+             copy.push_back(g.current_input_value<int>(id, 0));
+             copy.push_back(g.current_input_value<int>(id, 1));
+             copy.push_back(g.current_output_value<int>(id, 0));
+           }
+         }));
+
+  report("typed setters, 30k nodes", time_ns(iterations, [&] {
+           for (qgraph::NodeId id = 0; id < num_nodes; ++id) {
+             g.set_current_input_value<int>(id, 0, copy[3 * id]);
+             g.set_current_input_value<int>(id, 1, copy[3 * id + 1]);
+             g.set_current_output_value<int>(id, 0, copy[3 * id + 2]);
+           }
+         }));
+
+  qgraph::Checkpoint full;
+  report("full checkpoint, 30k nodes",
+         time_ns(iterations, [&] { full = g.checkpoint(); }));
+  std::printf("  %-48s %14zu bytes\n", "  size", full.data.size());
+
+  report("restore, 30k nodes", time_ns(iterations, [&] { g.restore(full); }));
+
+  auto base = g.checkpoint();
+  qgraph::Checkpoint delta;
+  int round = 0;
+  report("incremental checkpoint, 1% changed", time_ns(iterations, [&] {
+           // Writing an equal value does not count as a change.
+           ++round;
+           for (qgraph::NodeId id = 0; id < changed_nodes; ++id) {
+             g.set_current_output_value<int>(id, 0, id + round);
+           }
+           delta = g.checkpoint(base);
+         }));
+  std::printf("  %-48s %14zu\n", "  entries", delta.entries.size());
+  std::printf("  %-48s %14zu bytes\n", "  size", delta.data.size());
+};
@@ -0,0 +1,189 @@
+#include "QGraph/qevaluator.hh"
+#include "QGraph/qgraph.hh"
+#include "QGraph/qnode.hh"
+#include "bench.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// Import of a graph, issuing one `add_node` and `connect` call per node
+// and link, against a single `Graph::Edit`. The first evaluation is
+// included, as it sorts graphs built call by call while edits are
+// sorted on commit.
+//
+// Two imports are measured: a million links listed layer by layer,
+// which every output receives in order, and a quarter of a million
+// links from a few outputs feeding thousands of inputs each, listed in
+// no particular order.
+
+namespace {
+
+constexpr std::size_t fan_in = 50;
+constexpr std::size_t rounds = 3;
+
+using Clock = std::chrono::steady_clock;
+
+// Sums its inputs.
+class FanInNode : public qgraph::Node {
+public:
+  FanInNode() {
+    for (std::size_t i = 0; i < fan_in; ++i) {
+      add_input_socket<int>("In" + std::to_string(i)).with_default_value(1);
+    }
+    add_output_socket<int>("Sum").with_default_value(0);
+  };
+
+  void execute() override {
+    int sum = 0;
+    for (qgraph::SocketId i = 0; i < fan_in; ++i) {
+      sum += input_socket<int>(i)->current_value();
+    }
+    output_socket<int>(0)->set_current_value(sum);
+  };
+};
+
+struct LinkSpec {
+  qgraph::NodeId from;
+  qgraph::NodeId to;
+  qgraph::SocketId socket;
+};
+
+struct Import {
+  std::size_t nodes;
+  std::vector<LinkSpec> links;
+};
+
+// Every input of a node is fed by some node of the previous layer.
+Import layered() {
+  constexpr std::size_t layers = 21;
+  constexpr std::size_t layer_width = 1000;
+
+  Import import{layers * layer_width, {}};
+  for (std::size_t layer = 1; layer < layers; ++layer) {
+    for (std::size_t i = 0; i < layer_width; ++i) {
+      for (std::size_t k = 0; k < fan_in; ++k) {
+        auto from = (layer - 1) * layer_width + (i * 7 + k * 131) % layer_width;
+        import.links.push_back({static_cast<qgraph::NodeId>(from),
+                                static_cast<qgraph::NodeId>(
+                                    layer * layer_width + i),
+                                static_cast<qgraph::SocketId>(k)});
+      }
+    }
+  }
+  return import;
+};
+
+// Every input of the sinks is fed by one of a few hubs, each feeding
+// about 2000 inputs, in shuffled order.
+Import hubs() {
+  constexpr std::size_t hubs = 125;
+  constexpr std::size_t sinks = 5000;
+
+  Import import{hubs + sinks, {}};
+  for (std::size_t i = 0; i < sinks; ++i) {
+    for (std::size_t k = 0; k < fan_in; ++k) {
+      import.links.push_back({static_cast<qgraph::NodeId>((i * 7 + k) % hubs),
+                              static_cast<qgraph::NodeId>(hubs + i),
+                              static_cast<qgraph::SocketId>(k)});
+    }
+  }
+  std::shuffle(import.links.begin(), import.links.end(), std::mt19937(42));
+  return import;
+};
+
+double elapsed_ns(Clock::time_point since) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - since)
+      .count();
+};
+
+// Best time of every phase over all rounds, in nanoseconds.
+struct Phases {
+  double nodes = 1e300;
+  double links = 1e300;
+  double evaluation = 1e300;
+
+  void update(double n, double l, double e) {
+    nodes = std::min(nodes, n);
+    links = std::min(links, l);
+    evaluation = std::min(evaluation, e);
+  };
+};
+
+void import_by_calls(const Import &import, Phases &phases) {
+  qgraph::Graph g;
+
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < import.nodes; ++i) {
+    g.add_node<FanInNode>();
+  }
+  auto nodes = elapsed_ns(start);
+
+  start = Clock::now();
+  for (const auto &link : import.links) {
+    g.connect<int>(link.from, 0, link.to, link.socket);
+  }
+  auto links = elapsed_ns(start);
+
+  qgraph::Evaluator eval(g);
+  start = Clock::now();
+  eval.evaluate();
+  phases.update(nodes, links, elapsed_ns(start));
+};
+
+void import_by_edit(const Import &import, Phases &phases) {
+  qgraph::Graph g;
+  auto edit = g.begin_edit();
+  edit.reserve(import.nodes, import.links.size());
+
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < import.nodes; ++i) {
+    edit.add_node<FanInNode>();
+  }
+  auto nodes = elapsed_ns(start);
+
+  start = Clock::now();
+  for (const auto &link : import.links) {
+    edit.connect<int>(link.from, 0, link.to, link.socket);
+  }
+  edit.commit();
+  auto links = elapsed_ns(start);
+
+  qgraph::Evaluator eval(g);
+  start = Clock::now();
+  eval.evaluate();
+  phases.update(nodes, links, elapsed_ns(start));
+};
+
+void compare(const char *name, const Import &import) {
+  Phases by_calls;
+  Phases by_edit;
+  // Alternated, so that both reuse memory freed by earlier rounds.
+  for (std::size_t round = 0; round < rounds; ++round) {
+    import_by_calls(import, by_calls);
+    import_by_edit(import, by_edit);
+  }
+
+  std::printf("  %s, %zu nodes, %zu links\n", name, import.nodes,
+              import.links.size());
+  bench::report("add nodes, one call each", by_calls.nodes);
+  bench::report("link, one call each", by_calls.links);
+  bench::report("first evaluation, one call each", by_calls.evaluation);
+  bench::report("add nodes, one edit", by_edit.nodes);
+  bench::report("link and commit, one edit", by_edit.links);
+  bench::report("first evaluation, one edit", by_edit.evaluation);
+
+  std::printf("  %-48s %14.2fx\n", "speedup, linking and first evaluation",
+              (by_calls.links + by_calls.evaluation) /
+                  (by_edit.links + by_edit.evaluation));
+};
+
+} // namespace
+
+void bench::edit() {
+  compare("layered, links in order", layered());
+  compare("hubs, links shuffled", hubs());
+};
@@ -0,0 +1,90 @@
+#include "QGraph/qevaluator.hh"
+#include "QGraph/qgraph.hh"
+#include "QGraph/qnode.hh"
+#include "bench.hh"
+#include "perf.hh"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <vector>
+
+// Chains of math nodes whose ids are shuffled with respect to the
+// execution order, added to the graph while the heap is being
+// fragmented by unrelated allocations. Compares evaluation before and
+// after `Evaluator::optimize_layout`.
+
+namespace {
+
+constexpr std::size_t num_nodes = 30000;
+constexpr std::size_t chain_length = 64;
+constexpr std::size_t iterations = 50;
+
+void build_scattered(qgraph::Graph &g) {
+  std::mt19937 rng(42);
+  std::vector<std::unique_ptr<char[]>> noise;
+  std::uniform_int_distribution<std::size_t> noise_size(16, 512);
+
+  for (std::size_t i = 0; i < num_nodes; ++i) {
+    g.add_node<qgraph::MathNode>();
+    noise.emplace_back(new char[noise_size(rng)]);
+  }
+
+  std::vector<qgraph::NodeId> ids(num_nodes);
+  std::iota(ids.begin(), ids.end(), qgraph::NodeId{0});
+  std::shuffle(ids.begin(), ids.end(), rng);
+
+  for (std::size_t i = 0; i + 1 < num_nodes; ++i) {
+    if ((i + 1) % chain_length != 0) {
+      g.connect<int>(ids[i], qgraph::MathNode::Socket::RESULT, ids[i + 1],
+                     qgraph::MathNode::Socket::LHS);
+    }
+  }
+};
+
+void measure(const char *name, qgraph::Evaluator &eval) {
+  auto misses = bench::PerfCounter::cache_misses();
+  auto l1d = bench::PerfCounter::l1d_read_misses();
+
+  eval.evaluate();
+
+  misses.start();
+  l1d.start();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    eval.evaluate();
+  }
+  auto l1d_count = l1d.stop();
+  auto miss_count = misses.stop();
+
+  bench::report(name, bench::time_ns(iterations, [&] { eval.evaluate(); }));
+
+  if (misses.available()) {
+    std::printf("  %-48s %14.0f per eval\n", "  cache misses",
+                static_cast<double>(miss_count) / iterations);
+  } else {
+    std::printf("  %-48s %14s\n", "  cache misses", "n/a");
+  }
+
+  if (l1d.available()) {
+    std::printf("  %-48s %14.0f per eval\n", "  L1d read misses",
+                static_cast<double>(l1d_count) / iterations);
+  } else {
+    std::printf("  %-48s %14s\n", "  L1d read misses", "n/a");
+  }
+};
+
+} // namespace
+
+void bench::layout() {
+  qgraph::Graph g;
+  build_scattered(g);
+  qgraph::Evaluator eval(g);
+
+  measure("insertion layout", eval);
+
+  eval.optimize_layout();
+
+  measure("execution order layout", eval);
+};
@@ -0,0 +1,38 @@
+#include "bench.hh"
+#include <cstdio>
+#include <string_view>
+
+struct Suite {
+  std::string_view name;
+  void (*run)();
+};
+
+static constexpr Suite suites[] = {
+    {"payload", bench::payload},
+    {"scheduling", bench::scheduling},
+    {"layout", bench::layout},
+    {"snapshot", bench::snapshot},
+    {"partition", bench::partition},
+    {"checkpoint", bench::checkpoint},
+    {"memory", bench::memory},
+    {"edit", bench::edit},
+};
+
+// Usage: benchmarks [suite...]
+// Runs every suite when no name is given.
+int main(int argc, char **argv) {
+  for (const auto &suite : suites) {
+    bool selected = argc == 1;
+    for (int i = 1; i < argc; ++i) {
+      selected |= suite.name == argv[i];
+    }
+
+    if (selected) {
+      std::printf("[%.*s]\n", static_cast<int>(suite.name.size()),
+                  suite.name.data());
+      suite.run();
+    }
+  }
+
+  return 0;
+};
@@ -0,0 +1,73 @@
+#include "QGraph/qevaluator.hh"
+#include "QGraph/qgraph.hh"
+#include "QGraph/qmemory.hh"
+#include "QGraph/qnode.hh"
+#include "bench.hh"
+#include <cstddef>
+#include <cstdio>
+
+// Memory breakdown of chains of int math nodes before and
+// after `Graph::compact`, and evaluation time in both layouts.
+// The per socket figure leaves nodes and links out.
+
+namespace {
+
+constexpr std::size_t num_nodes = 30000;
+constexpr std::size_t sockets_per_node = 3;
+constexpr std::size_t chain_length = 64;
+constexpr std::size_t iterations = 50;
+
+void build(qgraph::Graph &g) {
+  for (std::size_t i = 0; i < num_nodes; ++i) {
+    g.add_node<qgraph::MathNode>();
+  }
+  for (std::size_t i = 0; i + 1 < num_nodes; ++i) {
+    if ((i + 1) % chain_length == 0) {
+      continue;
+    }
+    g.connect<int>(static_cast<qgraph::NodeId>(i),
+                   qgraph::MathNode::Socket::RESULT,
+                   static_cast<qgraph::NodeId>(i + 1),
+                   qgraph::MathNode::Socket::LHS);
+  }
+};
+
+double print(const char *name, const qgraph::MemoryStats &stats) {
+  auto per_socket = static_cast<double>(stats.total() - stats.nodes -
+                                        stats.links) /
+                    (num_nodes * sockets_per_node);
+
+  std::printf("  %s\n", name);
+  std::printf("    %-46s %14zu bytes\n", "nodes", stats.nodes);
+  std::printf("    %-46s %14zu bytes\n", "sockets", stats.sockets);
+  std::printf("    %-46s %14zu bytes\n", "labels", stats.labels);
+  std::printf("    %-46s %14zu bytes\n", "links", stats.links);
+  std::printf("    %-46s %14zu bytes\n", "values", stats.values);
+  std::printf("    %-46s %14.1f bytes\n", "per socket", per_socket);
+  return per_socket;
+};
+
+} // namespace
+
+void bench::memory() {
+  qgraph::Graph g;
+  build(g);
+  qgraph::Evaluator eval(g);
+
+  auto before = g.memory_stats();
+  auto standard = print("standard sockets, 30k nodes", before);
+  report("evaluate, standard sockets",
+         time_ns(iterations, [&] { eval.evaluate(); }));
+
+  g.compact();
+
+  auto after = g.memory_stats();
+  auto compact = print("compact sockets, 30k nodes", after);
+  report("evaluate, compact sockets",
+         time_ns(iterations, [&] { eval.evaluate(); }));
+
+  // Mostly shared label tables, see `Graph::compact`.
+  std::printf("  %-48s %14.2fx\n", "reduction per socket", standard / compact);
+  std::printf("  %-48s %14.2fx\n", "reduction, whole graph",
+              static_cast<double>(before.total()) / after.total());
+};
@@ -0,0 +1,77 @@
+#include "QGraph/qevaluator.hh"
+#include "QGraph/qgraph.hh"
+#include "QGraph/qnode.hh"
+#include "QGraph/qpartition.hh"
+#include "bench.hh"
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// CPU bound chains evaluated in one process against the same graph
+// split over several worker processes. A few links join neighboring
+// chains so that some values have to cross partitions.
+
+namespace {
+
+constexpr std::size_t chains = 4;
+constexpr std::size_t chain_length = 64;
+constexpr std::size_t iterations = 20;
+
+class SpinNode : public qgraph::Node {
+public:
+  SpinNode() {
+    add_input_socket<double>("In").with_default_value(1.0);
+    add_input_socket<double>("Side").with_default_value(0.0);
+    add_output_socket<double>("Out").with_default_value(0.0);
+  };
+
+  void execute() override {
+    double x = input_socket<double>(0)->current_value() +
+               input_socket<double>(1)->current_value();
+    for (int i = 0; i < 20000; ++i) {
+      x = x * 1.0000001 + 1e-9;
+    }
+    output_socket<double>(0)->set_current_value(x);
+  };
+};
+
+void build_chains(qgraph::Graph &g) {
+  for (std::size_t c = 0; c < chains; ++c) {
+    for (std::size_t i = 0; i < chain_length; ++i) {
+      g.add_node<SpinNode>();
+      auto node = static_cast<qgraph::NodeId>(g.num_of_nodes() - 1);
+      if (i > 0) {
+        g.connect<double>(node - 1, 0, node, 0);
+      }
+    }
+  }
+
+  // Cross links from the middle of every chain into the next one.
+  for (std::size_t c = 0; c + 1 < chains; ++c) {
+    auto from =
+        static_cast<qgraph::NodeId>(c * chain_length + chain_length / 2);
+    auto to = static_cast<qgraph::NodeId>(from + chain_length + 1);
+    g.connect<double>(from, 0, to, 1);
+  }
+};
+
+} // namespace
+
+void bench::partition() {
+  {
+    qgraph::Graph g;
+    build_chains(g);
+    qgraph::Evaluator eval(g);
+    report("single process", time_ns(iterations, [&] { eval.evaluate(); }));
+  }
+
+  for (std::size_t parts : {1, 2, 4}) {
+    qgraph::Graph g;
+    build_chains(g);
+    qgraph::PartitionedEvaluator eval(g, parts);
+
+    auto name = std::to_string(parts) + " worker processes (" +
+                std::to_string(eval.partition().cut_links) + " cut links)";
+    report(name, time_ns(iterations, [&] { eval.evaluate(); }));
+  }
+};
@@ -0,0 +1,107 @@
+#include "QGraph/qevaluator.hh"
+#include "QGraph/qgraph.hh"
+#include "QGraph/qnode.hh"
+#include "QGraph/qshared.hh"
+#include "bench.hh"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Multi-megabyte buffers fanned out from one producer to many consumers.
+// Compares plain value sockets, which deep copy the buffer on every edge,
+// against `qgraph::Shared` sockets, which share one allocation.
+
+namespace {
+
+using Buffer = std::vector<float>;
+using SharedBuffer = qgraph::Shared<Buffer>;
+
+constexpr std::size_t payload_floats = 1 << 20; // 4 MiB
+constexpr std::size_t consumers = 32;
+constexpr std::size_t iterations = 20;
+
+const Buffer &view(const Buffer &buffer) { return buffer; };
+const Buffer &view(const SharedBuffer &buffer) { return buffer.get(); };
+
+Buffer &edit(Buffer &buffer) { return buffer; };
+Buffer &edit(SharedBuffer &buffer) { return buffer.mutate(); };
+
+template <typename T> class SourceNode : public qgraph::Node {
+public:
+  SourceNode() {
+    add_output_socket<T>("Frame").with_default_value(
+        T(Buffer(payload_floats, 1.0f)));
+  };
+};
+
+template <typename T> class ReaderNode : public qgraph::Node {
+public:
+  float checksum = 0;
+
+  ReaderNode() { add_input_socket<T>("Frame"); };
+
+  void execute() override {
+    const Buffer &frame = view(input_socket<T>(0)->current_value());
+    checksum += frame.front() + frame.back();
+  };
+};
+
+// Writes into its input, forcing a private copy under `Shared`.
+template <typename T> class WriterNode : public qgraph::Node {
+public:
+  WriterNode() { add_input_socket<T>("Frame"); };
+
+  void execute() override {
+    edit(input_socket<T>(0)->mutable_current_value())[0] += 1.0f;
+  };
+};
+
+template <typename T> void build_fan_out(qgraph::Graph &g, bool one_writer) {
+  g.add_node<SourceNode<T>>();
+  for (std::size_t i = 0; i < consumers; ++i) {
+    if (one_writer && i == 0) {
+      g.add_node<WriterNode<T>>();
+    } else {
+      g.add_node<ReaderNode<T>>();
+    }
+    g.connect<T>(0, 0, static_cast<qgraph::NodeId>(i + 1), 0);
+  }
+};
+
+template <typename T> double run_fan_out(bool one_writer) {
+  qgraph::Graph g;
+  build_fan_out<T>(g, one_writer);
+  qgraph::Evaluator eval(g);
+
+  return bench::time_ns(iterations, [&] { eval.evaluate(); });
+};
+
+// Propagation as it was done before typed assignment: every edge goes
+// through `std::any`, copying the buffer into and out of it.
+double run_fan_out_through_any() {
+  qgraph::Graph g;
+  build_fan_out<Buffer>(g, false);
+
+  return bench::time_ns(iterations, [&] {
+    auto source = g.node(0)->get_untyped_output_socket(0);
+    for (std::size_t i = 1; i <= consumers; ++i) {
+      auto node = g.node(static_cast<qgraph::NodeId>(i));
+      node->get_untyped_input_socket(0)->set_current_value(
+          source->get_untyped_current_value());
+      node->execute();
+    }
+  });
+};
+
+} // namespace
+
+void bench::payload() {
+  const std::string shape = "4 MiB x " + std::to_string(consumers);
+
+  report("std::any propagation, " + shape, run_fan_out_through_any());
+  report("value sockets, " + shape, run_fan_out<Buffer>(false));
+  report("shared sockets, " + shape, run_fan_out<SharedBuffer>(false));
+  report("value sockets + 1 writer, " + shape, run_fan_out<Buffer>(true));
+  report("shared sockets + 1 writer, " + shape,
+         run_fan_out<SharedBuffer>(true));
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace bench {
+
+/// Hardware event counter for the calling thread, backed by
+/// `perf_event_open`. Counting is unavailable inside most containers
+/// and VMs or with a restrictive `perf_event_paranoid`; in that case
+/// `available()` is false and `stop()` returns zero.
+class PerfCounter {
+private:
+  int fd_ = -1;
+
+public:
+  PerfCounter(std::uint32_t type, std::uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  };
+
+  PerfCounter(const PerfCounter &) = delete;
+  PerfCounter &operator=(const PerfCounter &) = delete;
+
+  ~PerfCounter() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  };
+
+  static PerfCounter cache_misses() {
+    return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES};
+  };
+
+  static PerfCounter l1d_read_misses() {
+    return {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+  };
+
+  bool available() const { return fd_ >= 0; };
+
+  void start() {
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  };
+
+  std::uint64_t stop() {
+    std::uint64_t count = 0;
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+      if (::read(fd_, &count, sizeof(count)) != sizeof(count)) {
+        count = 0;
+      }
+    }
+    return count;
+  };
+};
+
+} // namespace bench
@@ -0,0 +1,89 @@
+#include "QGraph/qevaluator.hh"
+#include "QGraph/qgraph.hh"
+#include "QGraph/qnode.hh"
+#include "bench.hh"
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+// A few expensive nodes chained together among many cheap independent
+// ones. The chain head is ready from the start and runs first under
+// both schedules. With FIFO, the second chain node becomes ready behind
+// the cheap nodes still queued and waits for all of them, delaying the
+// rest of the chain by that much. Critical path runs the chain back to
+// back, so its makespan stays close to the 12 ms the chain needs alone.
+//
+// Nodes sleep instead of spinning to model a node occupying a worker
+// (I/O, offloaded kernels, ...). This keeps the makespan comparable
+// regardless of the number of cores of the machine.
+
+namespace {
+
+constexpr std::size_t threads = 4;
+constexpr std::size_t cheap_nodes = 48;
+constexpr std::size_t chain_length = 6;
+constexpr auto cheap_cost = std::chrono::microseconds(500);
+constexpr auto chain_cost = std::chrono::microseconds(2000);
+constexpr std::size_t iterations = 20;
+
+class WorkNode : public qgraph::Node {
+private:
+  std::chrono::microseconds cost_;
+
+public:
+  WorkNode(std::chrono::microseconds cost) : cost_(cost) {
+    add_input_socket<int>("In").with_default_value(0);
+    add_output_socket<int>("Out").with_default_value(0);
+  };
+
+  void execute() override {
+    std::this_thread::sleep_for(cost_);
+    output_socket<int>(0)->set_current_value(
+        input_socket<int>(0)->current_value() + 1);
+  };
+};
+
+void build_skewed(qgraph::Graph &g) {
+  for (std::size_t i = 0; i < cheap_nodes; ++i) {
+    g.add_node<WorkNode>(cheap_cost);
+  }
+
+  for (std::size_t i = 0; i < chain_length; ++i) {
+    g.add_node<WorkNode>(chain_cost);
+    if (i > 0) {
+      auto node = static_cast<qgraph::NodeId>(g.num_of_nodes() - 1);
+      g.connect<int>(node - 1, 0, node, 0);
+    }
+  }
+};
+
+double run_serial() {
+  qgraph::Graph g;
+  build_skewed(g);
+  qgraph::Evaluator eval(g);
+
+  return bench::time_ns(iterations / 4, [&] { eval.evaluate(); });
+};
+
+double run_skewed(qgraph::Evaluator::Schedule schedule) {
+  qgraph::Graph g;
+  build_skewed(g);
+  qgraph::Evaluator eval(g);
+
+  // Let the evaluator measure node costs before timing.
+  for (int i = 0; i < 3; ++i) {
+    eval.evaluate_parallel(threads, schedule);
+  }
+
+  return bench::time_ns(iterations,
+                        [&] { eval.evaluate_parallel(threads, schedule); });
+};
+
+} // namespace
+
+void bench::scheduling() {
+  report("serial", run_serial());
+  report("4 threads, FIFO", run_skewed(qgraph::Evaluator::FIFO));
+  report("4 threads, critical path",
+         run_skewed(qgraph::Evaluator::CRITICAL_PATH));
+};
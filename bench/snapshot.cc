@@ -0,0 +1,132 @@
+#include "QGraph/qevaluator.hh"
+#include "QGraph/qgraph.hh"
+#include "QGraph/qnode.hh"
+#include "QGraph/qsnapshot.hh"
+#include "bench.hh"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Evaluation latency while another thread keeps editing the topology.
+// Compares a graph guarded by one global lock, where evaluations wait
+// for edits in progress, against `VersionedGraph` snapshots.
+
+namespace {
+
+constexpr std::size_t num_nodes = 2000;
+constexpr std::size_t edits_per_batch = 200;
+constexpr std::size_t evaluations = 300;
+
+using Clock = std::chrono::steady_clock;
+
+void build_chain(qgraph::Graph &g) {
+  for (std::size_t i = 0; i < num_nodes; ++i) {
+    g.add_node<qgraph::MathNode>();
+    if (i > 0) {
+      auto node = static_cast<qgraph::NodeId>(i);
+      g.connect<int>(node - 1, qgraph::MathNode::Socket::RESULT, node,
+                     qgraph::MathNode::Socket::LHS);
+    }
+  }
+};
+
+void report_latencies(const char *name, std::vector<double> &samples) {
+  std::printf("  %-32s p50 %9.1f us   p99 %9.1f us   max %9.1f us\n", name,
+              bench::percentile(samples, 0.5) / 1000.0,
+              bench::percentile(samples, 0.99) / 1000.0,
+              bench::percentile(samples, 1.0) / 1000.0);
+};
+
+template <typename F> std::vector<double> sample(F &&evaluate) {
+  std::vector<double> samples;
+  for (std::size_t i = 0; i < evaluations; ++i) {
+    auto start = Clock::now();
+    evaluate();
+    samples.push_back(
+        std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+  }
+  return samples;
+};
+
+// Every batch toggles the right hand side input of some nodes
+// between their default value and the previous node's result.
+std::vector<double> run_global_lock(bool with_editor) {
+  qgraph::Graph g;
+  build_chain(g);
+  qgraph::Evaluator eval(g);
+  std::mutex lock;
+  std::atomic<bool> done = false;
+
+  std::thread editor([&] {
+    bool linked = false;
+    while (with_editor && !done) {
+      std::lock_guard guard(lock);
+      for (std::size_t i = 1; i <= edits_per_batch; ++i) {
+        auto node = static_cast<qgraph::NodeId>(i);
+        if (linked) {
+          g.node(node - 1)->output_socket<int>(0)->disconnect(node, 1);
+          g.node(node)->input_socket<int>(1)->disconnect();
+        } else {
+          g.connect<int>(node - 1, 0, node, 1);
+        }
+      }
+      linked = !linked;
+    }
+  });
+
+  auto samples = sample([&] {
+    std::lock_guard guard(lock);
+    eval.evaluate();
+  });
+
+  done = true;
+  editor.join();
+  return samples;
+};
+
+std::vector<double> run_snapshots(bool with_editor) {
+  qgraph::Graph base;
+  build_chain(base);
+  qgraph::VersionedGraph g(base);
+  std::atomic<bool> done = false;
+
+  std::thread editor([&] {
+    bool linked = false;
+    while (with_editor && !done) {
+      auto edit = g.edit();
+      for (std::size_t i = 1; i <= edits_per_batch; ++i) {
+        auto node = static_cast<qgraph::NodeId>(i);
+        if (linked) {
+          edit.disconnect(node - 1, 0, node, 1);
+        } else {
+          edit.connect<int>(node - 1, 0, node, 1);
+        }
+      }
+      edit.commit();
+      linked = !linked;
+    }
+  });
+
+  auto samples = sample([&] { g.evaluate(); });
+
+  done = true;
+  editor.join();
+  return samples;
+};
+
+} // namespace
+
+void bench::snapshot() {
+  auto samples = run_global_lock(false);
+  report_latencies("global lock, no edits", samples);
+  samples = run_global_lock(true);
+  report_latencies("global lock, editing", samples);
+  samples = run_snapshots(false);
+  report_latencies("snapshots, no edits", samples);
+  samples = run_snapshots(true);
+  report_latencies("snapshots, editing", samples);
+};
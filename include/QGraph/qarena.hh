@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+
+namespace qgraph {
+
+/// Contiguous storage for objects allocated one after another.
+///
+/// Objects are placed back to back in the order they are allocated and
+/// memory is only released once the arena itself is destroyed. The arena
+/// is reference counted by every allocator handed out for it, so it lives
+/// for as long as any object allocated from it.
+using Arena = std::shared_ptr<std::pmr::monotonic_buffer_resource>;
+
+inline Arena make_arena(std::size_t initial_size) {
+  return std::make_shared<std::pmr::monotonic_buffer_resource>(initial_size);
+};
+
+/// Allocator handing out memory from an `Arena`.
+/// Meant to be used with `std::allocate_shared`.
+template <typename T> class ArenaAllocator {
+private:
+  template <typename U> friend class ArenaAllocator;
+
+  Arena arena_;
+
+public:
+  using value_type = T;
+
+  ArenaAllocator(Arena arena) : arena_(std::move(arena)) {};
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena_) {};
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+  };
+
+  void deallocate(T *ptr, std::size_t n) {
+    arena_->deallocate(ptr, n * sizeof(T), alignof(T));
+  };
+
+  template <typename U> bool operator==(const ArenaAllocator<U> &rhs) const {
+    return arena_ == rhs.arena_;
+  };
+};
+
+} // namespace qgraph
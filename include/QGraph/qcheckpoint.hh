@@ -0,0 +1,105 @@
+#pragma once
+
+#include "QGraph/qtypes.hh"
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+namespace qgraph {
+
+/// Current values of the sockets of a graph, captured by
+/// `Graph::checkpoint` and applied back by `Graph::restore`.
+///
+/// All values live in a single contiguous buffer, with one entry per
+/// socket. An incremental checkpoint only holds the sockets that
+/// changed since the checkpoint it was taken against, and is restored
+/// on top of that one.
+struct Checkpoint {
+  struct Entry {
+    NodeId node;
+    SocketId socket;
+    bool is_output;
+    std::uint64_t offset;
+    std::uint64_t size;
+  };
+
+  std::vector<Entry> entries;
+  std::vector<std::byte> data;
+  // `Node::values_version` of every node when the checkpoint was
+  // taken, by node id, and how many times removing nodes had
+  // renumbered the graph. Only meaningful within the process that
+  // took the checkpoint.
+  std::vector<std::uint64_t> versions;
+  std::uint64_t renumbered = 0;
+  bool incremental = false;
+
+  /// Writes the checkpoint, without socket versions, so that it can be
+  /// restored by another process holding a graph of the same shape.
+  /// Integers are written in the byte order of the machine.
+  void write(std::ostream &out) const {
+    std::uint64_t header[] = {magic, incremental, entries.size(), data.size()};
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    for (const auto &entry : entries) {
+      write_field(out, entry.node);
+      write_field(out, entry.socket);
+      write_field(out, static_cast<std::uint8_t>(entry.is_output));
+      write_field(out, entry.offset);
+      write_field(out, entry.size);
+    }
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+  };
+
+  static Checkpoint read(std::istream &in) {
+    std::uint64_t header[4];
+    in.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (!in || header[0] != magic) {
+      throw std::runtime_error("Stream does not hold a checkpoint");
+    }
+
+    Checkpoint checkpoint;
+    checkpoint.incremental = header[1] != 0;
+    checkpoint.entries.resize(header[2]);
+    for (auto &entry : checkpoint.entries) {
+      std::uint8_t is_output = 0;
+      read_field(in, entry.node);
+      read_field(in, entry.socket);
+      read_field(in, is_output);
+      read_field(in, entry.offset);
+      read_field(in, entry.size);
+      entry.is_output = is_output != 0;
+    }
+    checkpoint.data.resize(header[3]);
+    in.read(reinterpret_cast<char *>(checkpoint.data.data()),
+            checkpoint.data.size());
+
+    if (!in) {
+      throw std::runtime_error("Checkpoint stream is truncated");
+    }
+
+    for (const auto &entry : checkpoint.entries) {
+      if (entry.offset > checkpoint.data.size() ||
+          entry.size > checkpoint.data.size() - entry.offset) {
+        throw std::runtime_error("Checkpoint entry is out of bounds");
+      }
+    }
+
+    return checkpoint;
+  };
+
+private:
+  // Tag at the start of every written checkpoint.
+  static constexpr std::uint64_t magic = 0x51474350'00000002;
+
+  template <typename T> static void write_field(std::ostream &out, T value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+  };
+
+  template <typename T> static void read_field(std::istream &in, T &value) {
+    in.read(reinterpret_cast<char *>(&value), sizeof(value));
+  };
+};
+
+} // namespace qgraph
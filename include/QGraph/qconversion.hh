@@ -0,0 +1,32 @@
+#pragma once
+
+#include <concepts>
+#include <type_traits>
+
+namespace qgraph {
+
+/// Converts values of type `From` into values of type `To` along links
+/// between sockets of different types. Arithmetic types convert into
+/// each other out of the box. Register a conversion for other types by
+/// specializing this template:
+///
+///     template <> struct qgraph::Conversion<Celsius, Kelvin> {
+///       static Kelvin convert(const Celsius &value);
+///     };
+template <typename From, typename To> struct Conversion;
+
+template <typename From, typename To>
+  requires std::is_arithmetic_v<From> && std::is_arithmetic_v<To>
+struct Conversion<From, To> {
+  static To convert(const From &value) { return static_cast<To>(value); };
+};
+
+/// Whether an output socket holding a `From` can be linked to an
+/// input socket holding a `To`.
+template <typename From, typename To>
+concept Convertible =
+    std::same_as<From, To> || requires(const From &value) {
+      { Conversion<From, To>::convert(value) } -> std::convertible_to<To>;
+    };
+
+} // namespace qgraph
@@ -1,23 +1,56 @@
 #pragma once
 
 #include <QGraph/qgraph.hh>
+#include <QGraph/qstop.hh>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstddef>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <queue>
 #include <ranges>
+#include <set>
+#include <thread>
+#include <utility>
 #include <vector>
 
 namespace qgraph {
+
 class Evaluator {
+public:
+  // Order in which ready nodes are picked during parallel evaluation.
+  enum Schedule {
+    // Ready nodes run in the order they became ready.
+    FIFO,
+    // Ready nodes with the longest remaining path run first.
+    CRITICAL_PATH
+  };
+
 private:
   enum Color { WHITE = 0, GRAY = 1, BLACK = 2 };
 
   Graph &graph_;
   std::vector<NodeId> execution_order_;
+  // Topology version of the graph `execution_order_` was computed for.
+  std::optional<std::uint64_t> sorted_version_;
   std::set<NodeId> visited_;
   bool is_valid_ = true;
   std::unordered_map<NodeId, Color> colors_;
 
+  // Exponential moving average of the measured `execute()` time
+  // of every node, in nanoseconds. Negative if never measured.
+  std::vector<double> node_costs_;
+  // Weight given to the newest measurement in `node_costs_`.
+  double smoothing_ = 0.25;
+  // Cost of the most expensive path from a node to any sink,
+  // the node itself included.
+  std::vector<double> critical_path_;
+
   /// This function checks if there is
   /// a directed cycle in the current graph
   /// and computes the evaluation order.
@@ -25,7 +58,76 @@ private:
   /// This is done by topological sorting the
   /// graph. If at some point the sorting detects
   /// a directed cycle, this function throws.
-  void verify_integrity() { dfs(); };
+  ///
+  /// Nothing is recomputed while the topology of the graph stays the
+  /// same. Otherwise measured costs are dropped too, as they are kept
+  /// by node id and removing nodes renumbers the ones after them.
+  void verify_integrity() {
+    auto version = graph_.topology_version();
+    if (version == sorted_version_) {
+      return;
+    }
+    sorted_version_ = version;
+
+    execution_order_.clear();
+    visited_.clear();
+    is_valid_ = true;
+    node_costs_.assign(graph_.num_of_nodes(), -1.0);
+
+    // Already sorted when the graph was last edited.
+    if (auto order = graph_.committed_order()) {
+      execution_order_.assign(order->rbegin(), order->rend());
+      return;
+    }
+
+    dfs();
+  };
+
+  // Runs `node` and propagates its outputs. Returns false, without
+  // propagating, if the node was told to stop while it ran, as it may
+  // have returned early, leaving partial values in its outputs.
+  bool run_node(NodeId node) {
+    auto start = std::chrono::steady_clock::now();
+    bool ran = run_to_end(*graph_.node(node));
+    auto end = std::chrono::steady_clock::now();
+
+    record_cost(node,
+                std::chrono::duration<double, std::nano>(end - start).count());
+
+    if (!ran) {
+      return false;
+    }
+
+    graph_.propagate_values(node);
+    return true;
+  };
+
+  static EvaluationStatus::Outcome stopped(const StopCondition &stop) {
+    return stop.cancelled() ? EvaluationStatus::CANCELLED
+                            : EvaluationStatus::DEADLINE_EXCEEDED;
+  };
+
+  void record_cost(NodeId node, double nanoseconds) {
+    auto &cost = node_costs_[node];
+    cost = cost < 0 ? nanoseconds
+                    : smoothing_ * nanoseconds + (1 - smoothing_) * cost;
+  };
+
+  // Longest remaining path from every node, using the measured
+  // costs. Unmeasured nodes count as one nanosecond so that, before
+  // any measurement, the path length in nodes is used instead.
+  void compute_critical_paths() {
+    critical_path_.assign(graph_.num_of_nodes(), 0.0);
+
+    // The execution order lists every node after all its successors.
+    for (auto node : execution_order_) {
+      double longest = 0.0;
+      for (const auto &link : graph_.node(node)->get_neighbors()) {
+        longest = std::max(longest, critical_path_[link.destination_node]);
+      }
+      critical_path_[node] = std::max(node_costs_[node], 1.0) + longest;
+    }
+  };
 
   // Recursive depth firt search.
   void dfs() {
@@ -72,21 +174,199 @@ public:
 
   auto get_execution_order() { return execution_order_; };
 
-  void evaluate() {
+  /// Runs every node of the graph in topological order, stopping
+  /// early if `stop` is reached. The condition is checked between
+  /// nodes, and nodes can check it inside `execute()` through
+  /// `Node::stop_requested`.
+  EvaluationStatus evaluate(const StopCondition &stop = {}) {
+    EvaluationStatus status;
 
     verify_integrity();
 
+    if (!is_valid_) {
+      status.outcome = EvaluationStatus::INVALID;
+      return status;
+    }
+
+    StopScope scope(stop);
+    status.completed.reserve(execution_order_.size());
+
+    for (auto node : execution_order_ | std::views::reverse) {
+      if (stop.reached()) {
+        status.outcome = stopped(stop);
+        break;
+      }
+      if (!run_node(node)) {
+        status.outcome = stopped(stop);
+        status.interrupted.push_back(node);
+        break;
+      }
+      status.completed.push_back(node);
+    }
+
+    return status;
+  };
+
+  /// Evaluates the graph using `num_threads` threads, the calling
+  /// thread included. A node runs as soon as every node feeding it
+  /// has finished; when several nodes are ready, `schedule` decides
+  /// which one runs first.
+  ///
+  /// If a node throws, no further nodes are started and the first
+  /// exception is rethrown once all threads have stopped. The same
+  /// happens, without exception, once `stop` is reached; see
+  /// `evaluate`.
+  EvaluationStatus evaluate_parallel(size_t num_threads,
+                                     Schedule schedule = CRITICAL_PATH,
+                                     const StopCondition &stop = {}) {
+    EvaluationStatus status;
+
+    verify_integrity();
+
+    if (!is_valid_) {
+      status.outcome = EvaluationStatus::INVALID;
+      return status;
+    }
+
+    compute_critical_paths();
+
+    std::vector<size_t> pending(graph_.num_of_nodes(), 0);
+    for (auto node : execution_order_) {
+      for (const auto &link : graph_.node(node)->get_neighbors()) {
+        pending[link.destination_node]++;
+      }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<NodeId> fifo;
+    std::priority_queue<std::pair<double, NodeId>> by_path;
+    size_t remaining = execution_order_.size();
+    bool halted = false;
+    std::exception_ptr error;
+    status.completed.reserve(execution_order_.size());
+
+    auto push = [&](NodeId node) {
+      if (schedule == FIFO) {
+        fifo.push_back(node);
+      } else {
+        by_path.emplace(critical_path_[node], node);
+      }
+    };
+
+    auto has_ready = [&] { return !fifo.empty() || !by_path.empty(); };
+
+    auto pop = [&] {
+      NodeId node;
+      if (schedule == FIFO) {
+        node = fifo.front();
+        fifo.pop_front();
+      } else {
+        node = by_path.top().second;
+        by_path.pop();
+      }
+      return node;
+    };
+
+    for (auto node : execution_order_ | std::views::reverse) {
+      if (pending[node] == 0) {
+        push(node);
+      }
+    }
+
+    auto worker = [&] {
+      StopScope scope(stop);
+      std::unique_lock lock(mutex);
+      while (true) {
+        cv.wait(lock, [&] {
+          return has_ready() || remaining == 0 || halted || error;
+        });
+
+        if (remaining == 0 || halted || error) {
+          return;
+        }
+
+        if (stop.reached()) {
+          halted = true;
+          cv.notify_all();
+          return;
+        }
+
+        auto node = pop();
+        lock.unlock();
+
+        bool ran = false;
+        try {
+          ran = run_node(node);
+        } catch (...) {
+          lock.lock();
+          if (!error) {
+            error = std::current_exception();
+          }
+          cv.notify_all();
+          return;
+        }
+
+        lock.lock();
+        if (!ran) {
+          halted = true;
+          status.interrupted.push_back(node);
+          cv.notify_all();
+          return;
+        }
+
+        status.completed.push_back(node);
+        remaining--;
+        for (const auto &link : graph_.node(node)->get_neighbors()) {
+          if (--pending[link.destination_node] == 0) {
+            push(link.destination_node);
+          }
+        }
+        cv.notify_all();
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::max(num_threads, size_t{1}); ++i) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    if (halted) {
+      status.outcome = stopped(stop);
+    }
+    return status;
+  };
+
+  /// Relocates the nodes of the graph so that they are
+  /// laid out in memory following the execution order.
+  /// See `Graph::optimize_layout`.
+  void optimize_layout() {
+    verify_integrity();
+
     if (is_valid_) {
-      std::ranges::for_each(execution_order_ | std::views::reverse,
-                            [this](const auto node) {
-                              graph_.execute_node(node);
-                              graph_.propagate_values(node);
-                            });
-    } else {
-      return;
+      graph_.optimize_layout(std::vector<NodeId>(execution_order_.rbegin(),
+                                                 execution_order_.rend()));
     }
   };
 
+  // Smoothed `execute()` time of a node in nanoseconds,
+  // or a negative value if it has not run yet.
+  double node_cost(NodeId node) const {
+    return node < node_costs_.size() ? node_costs_[node] : -1.0;
+  };
+
+  // Longest remaining path from a node as computed
+  // by the last parallel evaluation.
+  double critical_path(NodeId node) const { return critical_path_.at(node); };
+
   bool is_valid() { return is_valid_; }
 };
 } // namespace qgraph
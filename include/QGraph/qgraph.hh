@@ -1,15 +1,26 @@
 #pragma once
 
+#include "QGraph/qarena.hh"
+#include "QGraph/qcheckpoint.hh"
+#include "QGraph/qmemory.hh"
 #include "QGraph/qnode.hh"
 #include "QGraph/qsocket.hh"
 #include "QGraph/qtypes.hh"
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <stdexcept>
+#include <string>
 #include <sys/types.h>
+#include <tuple>
 #include <type_traits>
+#include <typeinfo>
 #include <utility>
 #include <vector>
 
@@ -20,9 +31,586 @@ concept DerivesNode = std::is_base_of<qgraph::Node, T>::value;
 
 class Graph {
 private:
+  using Relocator = std::shared_ptr<Node> (*)(const Node &, const Arena &);
+
+  // What depends on the concrete type of a node.
+  struct NodeType {
+    // Null unless the type is `Relocatable`.
+    Relocator relocate;
+    std::size_t size;
+  };
+
   std::vector<std::shared_ptr<qgraph::Node>> nodes_;
+  // Type of the node with the same index.
+  std::vector<NodeType> node_types_;
+  // Block holding the sockets since the last `compact`.
+  std::weak_ptr<const SocketBlock> socket_block_;
+  // Changes made through the graph, see `topology_version`.
+  std::uint64_t version_ = 0;
+  // Incremented whenever removing nodes renumbers the others, which
+  // voids the node versions held by earlier checkpoints.
+  std::uint64_t renumbered_ = 0;
+  // Topological order computed by the last committed edit, valid while
+  // the topology version is `committed_version_`.
+  std::optional<std::vector<NodeId>> committed_order_;
+  std::uint64_t committed_version_ = 0;
+
+  template <DerivesNode T>
+  static std::shared_ptr<Node> relocate_node(const Node &node,
+                                             const Arena &arena) {
+    if constexpr (std::is_copy_constructible_v<T>) {
+      return std::allocate_shared<T>(ArenaAllocator<T>(arena),
+                                     static_cast<const T &>(node));
+    } else {
+      return nullptr;
+    }
+  };
+
+  template <DerivesNode T> static NodeType node_type() {
+    return {Relocatable<T>::value ? &relocate_node<T> : nullptr, sizeof(T)};
+  };
+
+  Checkpoint capture(const Checkpoint *previous) const {
+    Checkpoint checkpoint;
+    checkpoint.incremental = previous != nullptr;
+    checkpoint.renumbered = renumbered_;
+    checkpoint.versions.resize(nodes_.size());
+    if (previous == nullptr) {
+      // Most graphs hold a few sockets per node.
+      checkpoint.entries.reserve(nodes_.size() * 4);
+    }
+
+    // Nodes `previous` knows about, under the same ids.
+    size_t known = 0;
+    if (previous != nullptr && previous->renumbered == renumbered_) {
+      known = std::min(previous->versions.size(), nodes_.size());
+    }
+
+    // Bytes of `data` in use. The buffer starts empty and doubles
+    // whenever a trivially copyable value does not fit.
+    size_t used = 0;
+
+    auto save = [&](NodeId id, SocketId index, bool is_output,
+                    const Socket &socket) {
+      auto offset = used;
+      if (auto size = socket.trivial_value_size()) {
+        if (used + size > checkpoint.data.size()) {
+          checkpoint.data.resize(2 * (used + size));
+        }
+        std::memcpy(checkpoint.data.data() + used, socket.current_value_data(),
+                    size);
+        used += size;
+      } else {
+        checkpoint.data.resize(used);
+        if (!socket.save_current_value(checkpoint.data)) {
+          throw std::invalid_argument(
+              "Socket value cannot be checkpointed for node " +
+              std::to_string(id) + ", register a qgraph::Serializer");
+        }
+        used = checkpoint.data.size();
+      }
+      checkpoint.entries.push_back(
+          {id, index, is_output, offset, used - offset});
+    };
+
+    for (NodeId id = 0; id < nodes_.size(); ++id) {
+      const auto &node = *nodes_[id];
+      auto version = node.values_version();
+      checkpoint.versions[id] = version;
+
+      // Sockets changed since `previous` carry a later version, and
+      // nodes without such sockets are skipped as a whole.
+      auto since = id < known ? previous->versions[id] : 0;
+      if (id < known && version == since) {
+        continue;
+      }
+
+      const auto &inputs = node.input_sockets();
+      const auto &outputs = node.output_sockets();
+      for (SocketId s = 0; s < inputs.size(); ++s) {
+        if (id >= known || inputs[s]->version() > since) {
+          save(id, s, false, *inputs[s]);
+        }
+      }
+      for (SocketId s = 0; s < outputs.size(); ++s) {
+        if (id >= known || outputs[s]->version() > since) {
+          save(id, s, true, *outputs[s]);
+        }
+      }
+    }
+
+    checkpoint.data.resize(used);
+    return checkpoint;
+  };
 
 public:
+  /// Batch of changes to a graph, see `Graph::begin_edit`. Nothing is
+  /// applied until `commit`; destroying an uncommitted edit discards it.
+  ///
+  /// Node ids refer to the graph as it was when the edit began, with
+  /// added nodes numbered after the existing ones. Removals act on the
+  /// links and nodes present before the edit, and additions are then
+  /// applied on top of them.
+  class Edit {
+  private:
+    // What links between two socket types need, shared by every
+    // pending link of those types.
+    struct LinkType {
+      // Whether sockets hold the types.
+      bool (*holds_output)(const Socket &socket);
+      bool (*holds_input)(const Socket &socket);
+      // See `OutSocket::reserve_links` and `OutSocket::merge_links`.
+      void (*reserve)(Socket &output, size_t links);
+      void (*merge)(Socket &output, size_t appended);
+      // Appends the link to `output` and sets the source of `input`.
+      void (*link)(Socket &output, NodeId from, Socket &input, NodeId to);
+    };
+
+    // Kept small, as imports add millions of them.
+    struct PendingLink {
+      NodeId from;
+      SocketId from_socket;
+      NodeId to;
+      SocketId to_socket;
+      const LinkType *type = nullptr;
+
+      bool operator<(const PendingLink &rhs) const {
+        return std::tie(from, from_socket, to, to_socket) <
+               std::tie(rhs.from, rhs.from_socket, rhs.to, rhs.to_socket);
+      };
+    };
+
+    // Null once committed.
+    Graph *graph_;
+    std::vector<std::shared_ptr<Node>> nodes_;
+    std::vector<NodeType> types_;
+    std::vector<PendingLink> connects_;
+    std::vector<PendingLink> disconnects_;
+    std::vector<NodeId> removed_;
+
+    // Comparing exact types is much cheaper than casting.
+    template <typename S> static bool holds(const Socket &socket) {
+      return typeid(socket) == typeid(S);
+    };
+
+    template <typename From>
+    static void reserve_links(Socket &output, size_t links) {
+      static_cast<OutSocket<From> &>(output).reserve_links(links);
+    };
+
+    template <typename From>
+    static void merge_links(Socket &output, size_t appended) {
+      static_cast<OutSocket<From> &>(output).merge_links(appended);
+    };
+
+    template <typename From, typename To>
+    static void link(Socket &output, NodeId from, Socket &input, NodeId to) {
+      auto &out = static_cast<OutSocket<From> &>(output);
+      auto &in = static_cast<InSocket<To> &>(input);
+      out.append_link({out.id(), to, in.id(), &convert_value<From, To>});
+      in.connect(from, out.id());
+    };
+
+    template <typename From, typename To>
+    static constexpr LinkType link_type{
+        &holds<OutSocket<From>>, &holds<InSocket<To>>, &reserve_links<From>,
+        &merge_links<From>, &link<From, To>};
+
+    void check_open() const {
+      if (graph_ == nullptr) {
+        throw std::runtime_error("Edit has already been committed");
+      }
+    };
+
+  public:
+    explicit Edit(Graph &graph) : graph_(&graph) {};
+    Edit(Edit &&) = default;
+    Edit &operator=(Edit &&) = default;
+
+    /// Presizes the edit for `nodes` added nodes and `links` added links.
+    void reserve(size_t nodes, size_t links) {
+      nodes_.reserve(nodes);
+      types_.reserve(nodes);
+      connects_.reserve(links);
+    };
+
+    /// Creates a node, returning the id it will have once committed.
+    template <DerivesNode T, typename... Args> NodeId add_node(Args... args) {
+      check_open();
+
+      // The largest id marks unconnected input sockets.
+      auto id = graph_->nodes_.size() + nodes_.size();
+      if (id >= std::numeric_limits<NodeId>::max()) {
+        throw std::length_error("Maximum number of nodes reached");
+      }
+
+      nodes_.push_back(std::make_shared<T>(std::forward<Args>(args)...));
+      nodes_.back()->set_id(id);
+      types_.push_back(node_type<T>());
+      return id;
+    };
+
+    /// Links two sockets as `Graph::connect` does. An input socket can
+    /// only be fed by one output, so any other link into `at_in_socket`
+    /// is replaced; within an edit, the last link wins. Ids and socket
+    /// types are checked by `commit`.
+    template <typename From, typename To = From>
+      requires Convertible<From, To>
+    void connect(NodeId from_node, SocketId at_out_socket, NodeId to_node,
+                 SocketId at_in_socket) {
+      check_open();
+      connects_.push_back({from_node, at_out_socket, to_node, at_in_socket,
+                           &link_type<From, To>});
+    };
+
+    /// Removes a link present before the edit, if any.
+    void disconnect(NodeId from_node, SocketId at_out_socket, NodeId to_node,
+                    SocketId at_in_socket) {
+      check_open();
+      disconnects_.push_back({from_node, at_out_socket, to_node, at_in_socket});
+    };
+
+    /// Removes a node and every link to or from it. As with
+    /// `delete_node`, later nodes move down one id at commit.
+    void remove_node(NodeId id) {
+      check_open();
+      removed_.push_back(id);
+    };
+
+    /// Applies every change at once and sorts the result a single time.
+    /// Throws, leaving the graph untouched, if an id or socket type is
+    /// wrong, if the result would contain a directed cycle or if memory
+    /// runs out. The edit cannot be used afterwards either way.
+    void commit() {
+      check_open();
+      auto &graph = *std::exchange(graph_, nullptr);
+
+      const size_t existing = graph.nodes_.size();
+      const size_t total = existing + nodes_.size();
+      auto node_at = [&](size_t id) -> Node & {
+        return id < existing ? *graph.nodes_[id] : *nodes_[id - existing];
+      };
+      auto check_node = [&](NodeId id) {
+        if (id >= total) {
+          throw std::out_of_range("Node ID is out of range.");
+        }
+      };
+
+      // Id of every node once removed nodes are dropped.
+      constexpr NodeId gone = std::numeric_limits<NodeId>::max();
+      std::vector<NodeId> final_id(total, 0);
+      for (auto id : removed_) {
+        check_node(id);
+        final_id[id] = gone;
+      }
+      NodeId kept = 0;
+      for (auto &id : final_id) {
+        id = id == gone ? gone : kept++;
+      }
+
+      for (const auto &pending : disconnects_) {
+        check_node(pending.from);
+        check_node(pending.to);
+      }
+
+      // Sockets are numbered node by node. Outputs, usually far fewer
+      // than inputs and linked many times each, are resolved up front.
+      std::vector<size_t> first_input(total + 1, 0);
+      std::vector<size_t> first_output(total + 1, 0);
+      for (size_t id = 0; id < total; ++id) {
+        first_input[id + 1] =
+            first_input[id] + node_at(id).input_sockets().size();
+        first_output[id + 1] =
+            first_output[id] + node_at(id).output_sockets().size();
+      }
+      std::vector<Socket *> outputs(first_output[total]);
+      for (size_t id = 0; id < total; ++id) {
+        std::ranges::transform(node_at(id).output_sockets(),
+                               outputs.begin() + first_output[id],
+                               &std::shared_ptr<Socket>::get);
+      }
+      auto input_at = [&](NodeId to, SocketId to_socket) {
+        return first_input[to] + to_socket;
+      };
+      auto output_at = [&](NodeId from, SocketId from_socket) {
+        return first_output[from] + from_socket;
+      };
+
+      // Every input records the added link feeding it, as its position
+      // in `connects_` plus one, or zero. Every output records the type
+      // of the links it was last checked against, which handles them.
+      // Every added link records its input.
+      std::vector<std::uint32_t> feeding(first_input[total], 0);
+      std::vector<Socket *> linked_inputs(connects_.size());
+      std::vector<const LinkType *> output_types(outputs.size(), nullptr);
+      auto feeder = [&](NodeId to, SocketId to_socket) -> std::uint32_t & {
+        return feeding[input_at(to, to_socket)];
+      };
+
+      for (size_t i = 0; i < connects_.size(); ++i) {
+        const auto &pending = connects_[i];
+        check_node(pending.from);
+        check_node(pending.to);
+
+        if (pending.from_socket >= first_output[pending.from + 1] -
+                                       first_output[pending.from] ||
+            pending.to_socket >=
+                first_input[pending.to + 1] - first_input[pending.to]) {
+          throw std::out_of_range("Socket ID is out of range.");
+        }
+
+        auto output = output_at(pending.from, pending.from_socket);
+        auto input = input_at(pending.to, pending.to_socket);
+        if (output_types[output] != pending.type) {
+          if (!pending.type->holds_output(*outputs[output])) {
+            throw std::invalid_argument(
+                "Linked sockets do not hold the requested types, nothing "
+                "was applied");
+          }
+          output_types[output] = pending.type;
+        }
+        auto &linked = *node_at(pending.to).input_sockets()[pending.to_socket];
+        if (!pending.type->holds_input(linked)) {
+          throw std::invalid_argument(
+              "Linked sockets do not hold the requested types, nothing was "
+              "applied");
+        }
+        feeding[input] = i + 1;
+        linked_inputs[i] = &linked;
+      }
+
+      // Whether an added link is part of the result.
+      auto wins = [&](size_t i) {
+        const auto &pending = connects_[i];
+        return feeder(pending.to, pending.to_socket) == i + 1 &&
+               final_id[pending.from] != gone && final_id[pending.to] != gone;
+      };
+
+      std::sort(disconnects_.begin(), disconnects_.end());
+
+      // Whether a link present before the edit survives it.
+      auto keeps = [&](NodeId from, const Link &link) {
+        return final_id[from] != gone &&
+               final_id[link.destination_node] != gone &&
+               feeder(link.destination_node, link.destination_socket) == 0 &&
+               (disconnects_.empty() ||
+                !std::binary_search(disconnects_.begin(), disconnects_.end(),
+                                    PendingLink{from, link.source_socket,
+                                                link.destination_node,
+                                                link.destination_socket}));
+      };
+
+      // Calls `f(from, to)` for every link of the result.
+      bool drops = false;
+      auto for_each_link = [&](auto &&f) {
+        for (NodeId id = 0; id < existing; ++id) {
+          for (const auto &socket : graph.nodes_[id]->output_sockets()) {
+            for (const auto &link : socket->get_neighbors()) {
+              if (keeps(id, link)) {
+                f(id, link.destination_node);
+              } else {
+                drops = true;
+              }
+            }
+          }
+        }
+        for (size_t i = 0; i < connects_.size(); ++i) {
+          if (wins(i)) {
+            f(connects_[i].from, connects_[i].to);
+          }
+        }
+      };
+
+      // Topological sort of the result, which fails on cycles.
+      std::vector<size_t> first_successor(total + 1, 0);
+      std::vector<size_t> unvisited(total, 0);
+      for_each_link([&](NodeId from, NodeId to) {
+        first_successor[from + 1]++;
+        unvisited[to]++;
+      });
+      for (size_t id = 0; id < total; ++id) {
+        first_successor[id + 1] += first_successor[id];
+      }
+      std::vector<NodeId> successors(first_successor[total]);
+      {
+        auto next = first_successor;
+        for_each_link(
+            [&](NodeId from, NodeId to) { successors[next[from]++] = to; });
+      }
+
+      std::vector<NodeId> order;
+      order.reserve(kept);
+      for (NodeId id = 0; id < total; ++id) {
+        if (final_id[id] != gone && unvisited[id] == 0) {
+          order.push_back(id);
+        }
+      }
+      for (size_t i = 0; i < order.size(); ++i) {
+        auto from = order[i];
+        for (auto k = first_successor[from]; k < first_successor[from + 1];
+             ++k) {
+          if (--unvisited[successors[k]] == 0) {
+            order.push_back(successors[k]);
+          }
+        }
+      }
+
+      if (order.size() != kept) {
+        throw std::invalid_argument(
+            "Edit would introduce a directed cycle, nothing was applied");
+      }
+
+      // Every allocation happens before the graph is changed. Outputs
+      // get room for all their added links at once.
+      std::vector<std::uint32_t> appended(outputs.size(), 0);
+      for (size_t i = 0; i < connects_.size(); ++i) {
+        if (wins(i)) {
+          appended[output_at(connects_[i].from, connects_[i].from_socket)]++;
+        }
+      }
+      for (size_t output = 0; output < outputs.size(); ++output) {
+        if (appended[output] != 0) {
+          output_types[output]->reserve(*outputs[output], appended[output]);
+        }
+      }
+      graph.nodes_.reserve(total);
+      graph.node_types_.reserve(total);
+
+      NodeId rewritten = 0;
+      std::function<bool(Link &)> rewrite = [&](Link &link) {
+        if (!keeps(rewritten, link)) {
+          return false;
+        }
+        link.destination_node = final_id[link.destination_node];
+        return true;
+      };
+
+      // Nothing below throws, and only merging links may allocate, which
+      // falls back to merging in place if memory runs out.
+      for (const auto &pending : disconnects_) {
+        if (pending.to_socket <
+                first_input[pending.to + 1] - first_input[pending.to] &&
+            feeder(pending.to, pending.to_socket) == 0) {
+          auto &input = *node_at(pending.to).input_sockets()[pending.to_socket];
+          if (input.source() == std::pair{pending.from, pending.from_socket}) {
+            input.set_source(std::nullopt);
+          }
+        }
+      }
+
+      // Inputs whose added link went away with its removed source.
+      for (size_t i = 0; i < connects_.size(); ++i) {
+        const auto &pending = connects_[i];
+        if (feeder(pending.to, pending.to_socket) == i + 1 &&
+            final_id[pending.to] != gone && final_id[pending.from] == gone) {
+          linked_inputs[i]->set_source(std::nullopt);
+        }
+      }
+
+      if (!removed_.empty()) {
+        for (NodeId id = 0; id < existing; ++id) {
+          if (final_id[id] == gone) {
+            continue;
+          }
+          for (const auto &input : graph.nodes_[id]->input_sockets()) {
+            if (auto source = input->source()) {
+              auto from = final_id[source->first];
+              input->set_source(from == gone ? std::nullopt
+                                             : std::optional{std::pair{
+                                                   from, source->second}});
+            }
+          }
+        }
+      }
+
+      if (drops || !removed_.empty()) {
+        for (rewritten = 0; rewritten < existing; ++rewritten) {
+          if (final_id[rewritten] == gone) {
+            continue;
+          }
+          for (const auto &output : graph.nodes_[rewritten]->output_sockets()) {
+            output->rewrite_links(rewrite);
+          }
+        }
+      }
+
+      // In input order, so that the links appended to every output are
+      // sorted already.
+      for (auto i : feeding) {
+        if (i != 0 && wins(i - 1)) {
+          const auto &pending = connects_[i - 1];
+          pending.type->link(
+              *outputs[output_at(pending.from, pending.from_socket)],
+              final_id[pending.from], *linked_inputs[i - 1],
+              final_id[pending.to]);
+        }
+      }
+      for (size_t output = 0; output < outputs.size(); ++output) {
+        if (appended[output] != 0) {
+          output_types[output]->merge(*outputs[output], appended[output]);
+        }
+      }
+
+      // Removed nodes no longer count in `topology_version`.
+      graph.version_++;
+      for (auto id : removed_) {
+        graph.version_ += node_at(id).topology_version();
+      }
+      graph.renumbered_ += !removed_.empty();
+
+      graph.nodes_.insert(graph.nodes_.end(),
+                          std::make_move_iterator(nodes_.begin()),
+                          std::make_move_iterator(nodes_.end()));
+      graph.node_types_.insert(graph.node_types_.end(), types_.begin(),
+                               types_.end());
+
+      if (!removed_.empty()) {
+        for (NodeId id = 0; id < total; ++id) {
+          if (auto to = final_id[id]; to != gone && to != id) {
+            graph.nodes_[to] = std::move(graph.nodes_[id]);
+            graph.node_types_[to] = graph.node_types_[id];
+            graph.nodes_[to]->set_id(to);
+          }
+        }
+        graph.nodes_.resize(kept);
+        graph.node_types_.resize(kept);
+      }
+
+      for (auto &id : order) {
+        id = final_id[id];
+      }
+      graph.committed_order_ = std::move(order);
+      graph.committed_version_ = graph.topology_version();
+    };
+  };
+
+  /// Starts a batch of changes, applied at once by `Edit::commit`.
+  /// Links are sorted into outputs and the graph is sorted once for
+  /// the whole batch, which pays off most when outputs gain many links
+  /// in no particular order. The graph must not be changed otherwise
+  /// until committed.
+  Edit begin_edit() { return Edit(*this); };
+
+  /// Grows whenever nodes, sockets or links of this graph change,
+  /// whether through the graph, its nodes or their sockets. Walks every
+  /// socket, so callers should keep the result rather than poll it.
+  std::uint64_t topology_version() const {
+    auto version = version_;
+    for (const auto &node : nodes_) {
+      version += node->topology_version();
+    }
+    return version;
+  };
+
+  /// Topological order computed by the last committed edit, which
+  /// evaluators reuse instead of sorting the graph again. Null once
+  /// the topology has changed since.
+  const std::vector<NodeId> *committed_order() const {
+    return committed_order_ && committed_version_ == topology_version()
+               ? &*committed_order_
+               : nullptr;
+  };
+
   size_t num_of_nodes() const { return nodes_.size(); }
 
   void execute_node(NodeId node) {
@@ -36,6 +624,8 @@ public:
   template <DerivesNode T, typename... Args> void add_node(Args... args) {
     nodes_.emplace_back(std::make_shared<T>(std::forward<Args>(args)...));
     nodes_.back()->set_id(nodes_.size() - 1);
+    node_types_.push_back(node_type<T>());
+    version_++;
   };
 
   template <typename F>
@@ -48,39 +638,143 @@ public:
     assert(to_node < nodes_.size());
 
     std::shared_ptr<qgraph::OutSocket<F>> a =
-        node(from_node)->output_socket<F>(at_out_socket).value();
+        node(from_node)->get_output_socket<F>(at_out_socket).value();
 
     std::shared_ptr<qgraph::InSocket<F>> b =
-        node(to_node)->input_socket<F>(at_in_socket).value();
+        node(to_node)->get_input_socket<F>(at_in_socket).value();
 
     a->connect(to_node, b->id());
     b->connect(from_node, a->id());
   };
 
-  template <typename F>
+  /// Links output `at_out_socket` of `from_node`, holding a `From`, to
+  /// input `at_in_socket` of `to_node`, holding a `To`. When the types
+  /// differ, values are converted along the link (see `Conversion`).
+  /// Throws if either socket does not hold the given type.
+  template <typename From, typename To = From>
+    requires Convertible<From, To>
   void connect(NodeId from_node, const SocketId at_out_socket, NodeId to_node,
                const SocketId at_in_socket) {
 
     assert(from_node < nodes_.size());
     assert(to_node < nodes_.size());
 
-    auto a = node(from_node);
-    auto a_socket = a->output_socket<F>(at_out_socket);
-
-    assert(at_out_socket < a->num_of_output_sockets());
-
-    auto b = node(to_node);
-    auto b_socket = b->input_socket<F>(at_in_socket);
-
-    assert(at_in_socket < b->num_of_input_sockets());
+    auto a_socket = node(from_node)->checked_output_socket<From>(at_out_socket);
+    auto b_socket = node(to_node)->checked_input_socket<To>(at_in_socket);
 
-    a_socket->connect(to_node, b_socket->id());
+    a_socket->connect(to_node, b_socket->id(), &convert_value<From, To>);
     b_socket->connect(from_node, a_socket->id());
   };
 
   // TODO: Does this invalidate ids? Write a test for it.
   // This can be achieved by using index masks.
-  void delete_node(qgraph::NodeId id) { nodes_.erase(nodes_.begin() + id); };
+  void delete_node(qgraph::NodeId id) {
+    // The removed node no longer counts in `topology_version`.
+    version_ += nodes_[id]->topology_version() + 1;
+    renumbered_++;
+    nodes_.erase(nodes_.begin() + id);
+    node_types_.erase(node_types_.begin() + id);
+  };
+
+  /// Moves nodes and their sockets into a single contiguous arena,
+  /// laid out following `order` (usually the execution order). Each
+  /// node is followed by its input and output sockets, so evaluating
+  /// in that order walks memory mostly forward.
+  ///
+  /// Only nodes of `Relocatable` types move, together with their
+  /// sockets; other nodes and their sockets stay in place. Node types
+  /// that are not copy constructible stay in place too, but their
+  /// sockets move. Node and socket pointers obtained before this call
+  /// keep pointing to the old copies and must be retrieved again.
+  ///
+  /// Only the node and socket objects are placed in the arena. Memory
+  /// they own, such as the storage of strings, vectors or sets held in
+  /// socket values or node members, stays wherever it was allocated,
+  /// so locality improves less for nodes dominated by such values.
+  void optimize_layout(const std::vector<NodeId> &order) {
+    size_t sockets = 0;
+    for (const auto &node : nodes_) {
+      sockets += node->num_of_input_sockets() + node->num_of_output_sockets();
+    }
+
+    auto arena = make_arena(256 * (nodes_.size() + sockets));
+
+    for (auto id : order) {
+      assert(id < nodes_.size());
+
+      auto relocate = node_types_[id].relocate;
+      if (relocate == nullptr) {
+        continue;
+      }
+
+      if (auto relocated = relocate(*nodes_[id], arena)) {
+        nodes_[id] = relocated;
+      }
+      nodes_[id]->relocate_sockets(arena);
+    }
+  };
+
+  /// Moves every socket of the graph into a single allocation and
+  /// packs the label lookup tables of nodes into sorted arrays. Nodes
+  /// with the same labels share a table, and equal default values are
+  /// shared among sockets when their type is hashable. Shared label
+  /// tables account for most of the savings; nodes and links do not
+  /// shrink at all.
+  ///
+  /// This trades speed for memory. Sockets end up in node order rather
+  /// than execution order, and evaluating a compacted graph can be
+  /// slower than before; see `optimize_layout` for speed.
+  ///
+  /// Sockets can still be retrieved by label through their node, but
+  /// compacted sockets no longer keep a copy of their own label, so
+  /// their `label()` is empty. Only the sockets of `Relocatable` node
+  /// types move; see `optimize_layout`. Socket pointers obtained before
+  /// the call must be retrieved again.
+  void compact() {
+    size_t bytes = 0;
+    for (NodeId id = 0; id < nodes_.size(); ++id) {
+      if (node_types_[id].relocate == nullptr) {
+        continue;
+      }
+      for (const auto &socket : nodes_[id]->input_sockets()) {
+        bytes += socket->object_size();
+      }
+      for (const auto &socket : nodes_[id]->output_sockets()) {
+        bytes += socket->object_size();
+      }
+    }
+
+    auto block = std::make_shared<SocketBlock>(bytes);
+    DefaultPool defaults;
+    Node::LabelPool labels;
+
+    for (NodeId id = 0; id < nodes_.size(); ++id) {
+      nodes_[id]->compact_labels(labels);
+      if (node_types_[id].relocate != nullptr) {
+        nodes_[id]->compact_sockets(block, defaults);
+      }
+    }
+
+    socket_block_ = block;
+  };
+
+  /// Approximate memory used by the graph, see `MemoryStats`.
+  MemoryStats memory_stats() const {
+    MemoryStats stats;
+    stats.nodes += nodes_.capacity() * sizeof(nodes_[0]) +
+                   node_types_.capacity() * sizeof(NodeType);
+
+    for (NodeId id = 0; id < nodes_.size(); ++id) {
+      stats.nodes += heap_block(node_types_[id].size + 2 * sizeof(void *));
+      nodes_[id]->count_memory(stats);
+    }
+
+    if (auto block = socket_block_.lock()) {
+      stats.sockets += block->bookkeeping_bytes();
+    }
+
+    return stats;
+  };
 
   std::shared_ptr<qgraph::Node> node(qgraph::NodeId id) const {
     return nodes_[id];
@@ -91,64 +785,102 @@ public:
   //
 
   template <typename T>
-  T current_output_value(NodeId for_node, SocketId at_socket) const {
+  const T &current_output_value(NodeId for_node, SocketId at_socket) const {
     return nodes_[for_node]->output_socket<T>(at_socket)->current_value();
   };
 
   template <typename T>
-  T default_output_value(NodeId for_node, SocketId at_socket) const {
+  const T &default_output_value(NodeId for_node, SocketId at_socket) const {
     return nodes_[for_node]->output_socket<T>(at_socket)->default_value();
   };
 
   template <typename T>
-  T current_input_value(NodeId for_node, SocketId at_socket) const {
+  const T &current_input_value(NodeId for_node, SocketId at_socket) const {
     return nodes_[for_node]->input_socket<T>(at_socket)->current_value();
   };
 
   template <typename T>
-  T default_input_value(NodeId for_node, SocketId at_socket) const {
-    return nodes_[for_node]->input_socket<T>(at_socket)->get_default_value();
+  const T &default_input_value(NodeId for_node, SocketId at_socket) const {
+    return nodes_[for_node]->input_socket<T>(at_socket)->default_value();
   };
 
   template <typename T>
   void set_current_output_value(NodeId for_node, SocketId at_socket, T to) {
-    nodes_[for_node]->output_socket<T>(at_socket)->set_current_value(to);
+    nodes_[for_node]->output_socket<T>(at_socket)->set_current_value(
+        std::move(to));
   };
 
   template <typename T>
   void set_default_output_value(NodeId for_node, SocketId at_socket, T to) {
-    nodes_[for_node]->output_socket<T>(at_socket)->set_default_value(to);
+    nodes_[for_node]->output_socket<T>(at_socket)->set_default_value(
+        std::move(to));
   };
 
   template <typename T>
   void set_current_input_value(NodeId for_node, SocketId at_socket, T to) {
-    nodes_[for_node]->input_socket<T>(at_socket)->set_current_value(to);
+    nodes_[for_node]->input_socket<T>(at_socket)->set_current_value(
+        std::move(to));
   };
 
   template <typename T>
   void set_default_input_value(NodeId for_node, SocketId at_socket, T to) {
-    nodes_[for_node]->input_socket<T>(at_socket)->set_default_value(to);
+    nodes_[for_node]->input_socket<T>(at_socket)->set_default_value(
+        std::move(to));
+  };
+
+  //
+  // Checkpoints.
+  //
+
+  /// Captures the current value of every socket.
+  /// Throws if a value can neither be copied bytewise
+  /// nor has a registered `Serializer`.
+  Checkpoint checkpoint() const { return capture(nullptr); };
+
+  /// Captures the current value of every socket that changed since
+  /// `previous` was taken. Restoring it requires restoring `previous`
+  /// (and whatever it was taken against) first.
+  Checkpoint checkpoint(const Checkpoint &previous) const {
+    return capture(&previous);
+  };
+
+  /// Sets the current value of every socket held by `checkpoint`.
+  void restore(const Checkpoint &checkpoint) {
+    // Entries come node after node, so nodes are looked up once.
+    const Node *node = nullptr;
+    NodeId at = 0;
+    for (const auto &entry : checkpoint.entries) {
+      assert(entry.offset + entry.size <= checkpoint.data.size());
+
+      if (node == nullptr || at != entry.node) {
+        node = nodes_.at(entry.node).get();
+        at = entry.node;
+      }
+      const auto &sockets =
+          entry.is_output ? node->output_sockets() : node->input_sockets();
+
+      auto data = checkpoint.data.data() + entry.offset;
+      if (!sockets.at(entry.socket)->load_current_value(data, entry.size)) {
+        throw std::invalid_argument(
+            "Socket value cannot be restored for node " +
+            std::to_string(entry.node));
+      }
+    }
   };
 
   void propagate_values(NodeId for_node) const {
-    // TODO: Currently this function only works if
-    // the source and destination sockets are of the same
-    // type. It would be a good idea to make this work also
-    // if they have types A and B such that A can be casted
-    // into B.
-    auto neighbors = node(for_node)->get_neighbors();
-
-    std::ranges::for_each(neighbors, [this, for_node](const auto &link) {
-      auto [src_socket, dst_node, dst_socket] = link;
-
-      auto source_node = node(for_node);
-      auto dest_node = node(dst_node);
-      auto output_socket = source_node->get_untyped_output_socket(src_socket);
-      auto input_socket = dest_node->get_untyped_input_socket(dst_socket);
-
-      auto src_value = output_socket->get_untyped_current_value();
-      input_socket->set_current_value(src_value);
-    });
+    const auto &source_node = nodes_[for_node];
+
+    std::ranges::for_each(
+        source_node->get_neighbors(), [this, &source_node](const auto &link) {
+          auto output_socket =
+              source_node->get_untyped_output_socket(link.source_socket);
+          auto input_socket =
+              nodes_[link.destination_node]->get_untyped_input_socket(
+                  link.destination_socket);
+
+          transfer_value(link, *output_socket, *input_socket);
+        });
   };
 };
 }; // namespace qgraph
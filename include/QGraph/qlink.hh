@@ -3,10 +3,19 @@
 #include <tuple>
 
 namespace qgraph {
+class Socket;
+
+// Copies the current value of an output socket into an input socket,
+// converting it to the type of the input socket if needed.
+using Converter = void (*)(const Socket &from, Socket &to);
+
 struct Link {
   SocketId source_socket;
   NodeId destination_node;
   SocketId destination_socket;
+  // Resolved when the link is created. Links without a converter copy
+  // the value as is, so both sockets must hold the same type.
+  Converter convert = nullptr;
 
   bool operator<(const Link &rhs) const {
     return std::tie(source_socket, destination_node, destination_socket) <
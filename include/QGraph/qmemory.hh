@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+
+namespace qgraph {
+
+/// Approximate memory used by a graph, in bytes, broken down by what
+/// the memory holds. See `Graph::memory_stats`.
+struct MemoryStats {
+  // Node objects and the table of nodes of the graph.
+  std::size_t nodes = 0;
+  // Socket objects and the pointers to them, without the members
+  // counted below.
+  std::size_t sockets = 0;
+  // Socket labels, including the label lookup tables of nodes.
+  std::size_t labels = 0;
+  // Links leaving output sockets.
+  std::size_t links = 0;
+  // Current and default values, including memory they own.
+  std::size_t values = 0;
+
+  std::size_t total() const {
+    return nodes + sockets + labels + links + values;
+  };
+};
+
+// Bytes taken by a heap allocation of `bytes`, assuming a general
+// purpose allocator with a one pointer header and 16 byte granularity.
+inline std::size_t heap_block(std::size_t bytes) {
+  constexpr std::size_t granularity = 16;
+  return (bytes + sizeof(void *) + granularity - 1) / granularity *
+         granularity;
+};
+
+// Bytes owned by `value` outside of the object itself. Only contiguous
+// containers are inspected; anything else is assumed to own nothing.
+template <typename T> std::size_t owned_bytes(const T &value) {
+  if constexpr (requires {
+                  value.data();
+                  value.capacity();
+                }) {
+    auto data = static_cast<const void *>(value.data());
+    auto begin = static_cast<const void *>(&value);
+    auto end = static_cast<const void *>(&value + 1);
+
+    // Small buffer optimization, the elements live inside `value`.
+    std::less<const void *> less;
+    if (!less(data, begin) && less(data, end)) {
+      return 0;
+    }
+
+    return value.capacity() == 0
+               ? 0
+               : heap_block(value.capacity() * sizeof(*value.data()));
+  } else {
+    return 0;
+  }
+};
+
+} // namespace qgraph
@@ -1,16 +1,22 @@
 #pragma once
 
 #include "QGraph/qtypes.hh"
+#include <QGraph/qmemory.hh>
 #include <QGraph/qsocket.hh>
+#include <QGraph/qstop.hh>
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <limits>
 #include <memory>
 #include <optional>
 #include <ranges>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace qgraph {
@@ -30,9 +36,100 @@ private:
   std::vector<std::shared_ptr<qgraph::Socket>> in_sockets_;
   std::vector<std::shared_ptr<qgraph::Socket>> out_sockets_;
 
+  // See `values_version`. Sockets hold a pointer to it, so copies of
+  // the node must adopt their sockets again, see `adopt_sockets`.
+  std::uint64_t values_version_ = 0;
+
+  // Label lookup tables packed by `compact_labels`, sorted by label.
+  // Used instead of the tables above while set. Never changed, so it
+  // can be shared with copies of the node and with other nodes.
+  struct PackedLabels {
+    std::vector<std::pair<std::string, std::uint16_t>> in;
+    std::vector<std::pair<std::string, std::uint16_t>> out;
+
+    auto operator<=>(const PackedLabels &) const = default;
+  };
+  std::shared_ptr<const PackedLabels> packed_labels_;
+
+  using LabelTable = std::unordered_map<std::string, std::uint16_t>;
+  using PackedTable = std::vector<std::pair<std::string, std::uint16_t>>;
+
+  static std::optional<std::uint16_t>
+  find_label(const LabelTable &table, const PackedTable *packed,
+             const std::string &label) {
+    if (packed != nullptr) {
+      auto at = std::ranges::lower_bound(*packed, label, {},
+                                         &PackedTable::value_type::first);
+      if (at != packed->end() && at->first == label) {
+        return at->second;
+      }
+    } else if (auto at = table.find(label); at != table.end()) {
+      return at->second;
+    }
+    return std::nullopt;
+  };
+
+  static PackedTable pack(LabelTable &table) {
+    PackedTable packed;
+    packed.reserve(table.size());
+    for (auto &[label, id] : table) {
+      packed.emplace_back(label, id);
+    }
+    std::ranges::sort(packed);
+    // Swap, clearing would keep the buckets.
+    LabelTable().swap(table);
+    return packed;
+  };
+
+  // Moves packed labels back into the lookup tables, before a new
+  // socket is added.
+  void unpack_labels() {
+    if (packed_labels_ == nullptr) {
+      return;
+    }
+    in_sockets_labels_.insert(packed_labels_->in.begin(),
+                              packed_labels_->in.end());
+    out_sockets_labels_.insert(packed_labels_->out.begin(),
+                               packed_labels_->out.end());
+    packed_labels_.reset();
+  };
+
+  void adopt_sockets() {
+    for (const auto *sockets : {&in_sockets_, &out_sockets_}) {
+      for (const auto &socket : *sockets) {
+        socket->set_owner(&values_version_);
+      }
+    }
+  };
+
 public:
+  /// Packed label tables found while compacting a graph. Nodes with
+  /// the same labels share a single table.
+  class LabelPool {
+  private:
+    friend class Node;
+
+    struct Less {
+      bool operator()(const std::shared_ptr<const PackedLabels> &lhs,
+                      const std::shared_ptr<const PackedLabels> &rhs) const {
+        return *lhs < *rhs;
+      };
+    };
+
+    std::set<std::shared_ptr<const PackedLabels>, Less> tables_;
+  };
+
   Node() {};
 
+  // Sockets shared with a copy of the node may outlive it.
+  ~Node() {
+    for (const auto *sockets : {&in_sockets_, &out_sockets_}) {
+      for (const auto &socket : *sockets) {
+        socket->release_owner(&values_version_);
+      }
+    }
+  };
+
   NodeId id() const {
     return id_.has_value() ? id_.value()
                            : throw std::runtime_error("Node has no id");
@@ -44,6 +141,32 @@ public:
   auto num_of_input_sockets() { return in_sockets_.size(); };
   auto num_of_output_sockets() { return out_sockets_.size(); };
 
+  const std::vector<std::shared_ptr<Socket>> &input_sockets() const {
+    return in_sockets_;
+  };
+  const std::vector<std::shared_ptr<Socket>> &output_sockets() const {
+    return out_sockets_;
+  };
+
+  // Grows whenever the value of one of the node's sockets may have
+  // changed, and whenever a socket is added. Sockets take their own
+  // version from it, so a socket changed after the node was at version
+  // `v` has a version greater than `v`.
+  std::uint64_t values_version() const { return values_version_; };
+
+  // Grows whenever a socket is added or links to or from one of the
+  // node's sockets change, see `Graph::topology_version`.
+  std::uint64_t topology_version() const {
+    std::uint64_t version = in_sockets_.size() + out_sockets_.size();
+    for (const auto &socket : in_sockets_) {
+      version += socket->links_version();
+    }
+    for (const auto &socket : out_sockets_) {
+      version += socket->links_version();
+    }
+    return version;
+  };
+
   std::shared_ptr<Socket> get_untyped_input_socket(SocketId socket) {
     if (socket < in_sockets_.size()) {
       return in_sockets_[socket];
@@ -72,6 +195,7 @@ public:
       throw std::invalid_argument("Socket label cannot be empty");
     }
 
+    unpack_labels();
     if (in_sockets_labels_.size() >= std::numeric_limits<uint16_t>::max()) {
       throw std::runtime_error("Maximum number of input sockets reached");
     }
@@ -80,6 +204,7 @@ public:
       auto new_socket = std::make_shared<qgraph::InSocket<T>>(label);
       this->in_sockets_.push_back(new_socket);
       new_socket->set_id(this->in_sockets_.size() - 1);
+      new_socket->set_owner(&values_version_);
       in_sockets_labels_.insert({label, new_socket->id()});
       return builder::InSocketBuilder<T>(new_socket);
     } else {
@@ -96,6 +221,7 @@ public:
       throw std::invalid_argument("Socket label cannot be empty");
     }
 
+    unpack_labels();
     if (out_sockets_labels_.size() >= std::numeric_limits<uint16_t>::max()) {
       throw std::runtime_error("Maximum number of output sockets reached");
     }
@@ -104,6 +230,7 @@ public:
       auto new_socket = std::make_shared<qgraph::OutSocket<T>>(label);
       this->out_sockets_.push_back(new_socket);
       new_socket->set_id(this->out_sockets_.size() - 1);
+      new_socket->set_owner(&values_version_);
       out_sockets_labels_.insert({label, new_socket->id()});
       return builder::OutSocketBuilder<T>(new_socket);
     } else {
@@ -116,9 +243,10 @@ public:
   [[deprecated("Retrieve socket by id instead")]]
   std::optional<std::shared_ptr<qgraph::InSocket<T>>>
   get_input_socket(const std::string &label) {
-    if (auto id = in_sockets_labels_.find(label);
-        id != in_sockets_labels_.end()) {
-      auto base_prt = this->in_sockets_[id->second];
+    if (auto id = find_label(in_sockets_labels_,
+                             packed_labels_ ? &packed_labels_->in : nullptr,
+                             label)) {
+      auto base_prt = this->in_sockets_[*id];
       return std::static_pointer_cast<qgraph::InSocket<T>>(base_prt);
     }
 
@@ -139,9 +267,10 @@ public:
   [[deprecated("Retrieve socket by id instead")]]
   std::optional<std::shared_ptr<qgraph::OutSocket<T>>>
   get_output_socket(const std::string &label) {
-    if (auto id = out_sockets_labels_.find(label);
-        id != out_sockets_labels_.end()) {
-      auto base_ptr = this->out_sockets_[id->second];
+    if (auto id = find_label(out_sockets_labels_,
+                             packed_labels_ ? &packed_labels_->out : nullptr,
+                             label)) {
+      auto base_ptr = this->out_sockets_[*id];
       return std::static_pointer_cast<qgraph::OutSocket<T>>(base_ptr);
     }
 
@@ -157,6 +286,121 @@ public:
                             std::to_string(id));
   };
 
+  // Same as `input_socket`, but throws if the socket does not hold a
+  // `T`. Meant for creating links, not for use inside `execute()`.
+  template <typename T>
+  std::shared_ptr<InSocket<T>> checked_input_socket(const SocketId id) {
+    auto socket = std::dynamic_pointer_cast<InSocket<T>>(
+        get_untyped_input_socket(id));
+    if (!socket) {
+      throw std::invalid_argument("Input socket " + std::to_string(id) +
+                                  " does not hold the requested type");
+    }
+    return socket;
+  };
+
+  template <typename T>
+  std::shared_ptr<OutSocket<T>> checked_output_socket(const SocketId id) {
+    auto socket = std::dynamic_pointer_cast<OutSocket<T>>(
+        get_untyped_output_socket(id));
+    if (!socket) {
+      throw std::invalid_argument("Output socket " + std::to_string(id) +
+                                  " does not hold the requested type");
+    }
+    return socket;
+  };
+
+  // Moves every socket of this node into `arena`, inputs first, so
+  // that the sockets of a node are laid out next to each other.
+  void relocate_sockets(const Arena &arena) {
+    for (auto &socket : in_sockets_) {
+      if (auto relocated = socket->relocate(arena)) {
+        socket->release_owner(&values_version_);
+        socket = relocated;
+      }
+    }
+    for (auto &socket : out_sockets_) {
+      if (auto relocated = socket->relocate(arena)) {
+        socket->release_owner(&values_version_);
+        socket = relocated;
+      }
+    }
+    adopt_sockets();
+  };
+
+  // Packs the label lookup tables into sorted arrays, shared through
+  // `pool` with nodes holding the same labels. Sockets can still be
+  // retrieved by label.
+  void compact_labels(LabelPool &pool) {
+    if (packed_labels_ != nullptr || (in_sockets_labels_.empty() &&
+                                      out_sockets_labels_.empty())) {
+      return;
+    }
+    auto packed = std::make_shared<const PackedLabels>(PackedLabels{
+        pack(in_sockets_labels_), pack(out_sockets_labels_)});
+    packed_labels_ = *pool.tables_.insert(std::move(packed)).first;
+  };
+
+  // Moves every socket of this node into `block`. See `Graph::compact`.
+  void compact_sockets(const std::shared_ptr<SocketBlock> &block,
+                       DefaultPool &defaults) {
+    for (auto &socket : in_sockets_) {
+      if (auto compacted = socket->compact_into(*block, defaults)) {
+        socket->release_owner(&values_version_);
+        socket = std::shared_ptr<Socket>(block, compacted);
+      }
+    }
+    for (auto &socket : out_sockets_) {
+      if (auto compacted = socket->compact_into(*block, defaults)) {
+        socket->release_owner(&values_version_);
+        socket = std::shared_ptr<Socket>(block, compacted);
+      }
+    }
+    adopt_sockets();
+  };
+
+  // Adds the memory of the sockets of this node to `stats`. The node
+  // object itself is counted by the graph, which knows its type.
+  void count_memory(MemoryStats &stats) const {
+    stats.sockets += (in_sockets_.capacity() + out_sockets_.capacity()) *
+                     sizeof(std::shared_ptr<Socket>);
+
+    for (const auto *sockets : {&in_sockets_, &out_sockets_}) {
+      for (const auto &socket : *sockets) {
+        socket->count_memory(stats);
+
+        // Sockets outside a block carry their own allocation,
+        // shared with the reference counts.
+        if (!socket->in_block()) {
+          auto size = socket->object_size();
+          stats.sockets += heap_block(size + 2 * sizeof(void *)) - size;
+        }
+      }
+    }
+
+    for (const auto *labels : {&in_sockets_labels_, &out_sockets_labels_}) {
+      stats.labels += labels->bucket_count() * sizeof(void *);
+      for (const auto &[label, id] : *labels) {
+        // Entries also hold the next entry and the cached hash.
+        stats.labels +=
+            heap_block(sizeof(*labels->begin()) + 2 * sizeof(void *)) +
+            owned_bytes(label);
+      }
+    }
+
+    if (packed_labels_ != nullptr) {
+      stats.labels +=
+          heap_block(sizeof(PackedLabels) + 2 * sizeof(void *)) /
+          packed_labels_.use_count();
+      for (const auto *labels : {&packed_labels_->in, &packed_labels_->out}) {
+        stats.labels += owned_bytes(*labels) / packed_labels_.use_count();
+        for (const auto &[label, id] : *labels) {
+          stats.labels += owned_bytes(label) / packed_labels_.use_count();
+        }
+      }
+    }
+  };
+
   auto get_neighbors() const {
     return out_sockets_ | std::views::transform([](const auto &socket) {
              return socket->get_neighbors();
@@ -164,9 +408,35 @@ public:
            std::views::join;
   }
 
+  // Whether the evaluation running this node has been asked to stop.
+  // Long running nodes can poll this inside `execute()` and return
+  // early. Once this returned true, the node counts as interrupted and
+  // its outputs are not propagated. Only meaningful on the thread
+  // calling `execute()`.
+  static bool stop_requested() {
+    if (active_stop.reached()) {
+      active_stop.seen = true;
+      return true;
+    }
+    return false;
+  };
+
   virtual void execute() {};
 };
 
+/// Opts a node type into being moved by `Graph::optimize_layout` and
+/// `Graph::compact`, which copy the node and replace its sockets:
+///
+///   template <> struct qgraph::Relocatable<MyNode> : std::true_type {};
+///
+/// Only types that keep no pointer to the node or to its own sockets,
+/// such as a socket cached by the constructor, may opt in. Nodes of
+/// any other type, types derived from one that opted in included, stay
+/// in place along with their sockets.
+template <typename T> struct Relocatable : std::false_type {};
+
+template <> struct Relocatable<Node> : std::true_type {};
+
 class MathNode : public Node {
 public:
   enum Socket {
@@ -184,14 +454,22 @@ public:
   };
 
   void execute() override {
-    auto a = get_input_socket<int>("A").value()->current_value();
-    auto b = get_input_socket<int>("B").value()->current_value();
-    get_output_socket<int>("C").value()->set_current_value(a + b);
+    auto a = input_socket<int>(LHS)->current_value();
+    auto b = input_socket<int>(RHS)->current_value();
+    output_socket<int>(RESULT)->set_current_value(a + b);
   };
 };
 
 class IncrNode : public Node {
 public:
+  enum Socket {
+    // Input sockets
+    VALUE = 0,
+    CONDITION = 1,
+    // Output sockets
+    RESULT = 0
+  };
+
   IncrNode() {
     add_input_socket<int>("Value").with_default_value(10);
     add_input_socket<bool>("Condition").with_default_value(true);
@@ -199,11 +477,10 @@ public:
   };
 
   void execute() override {
-    bool condition =
-        get_input_socket<bool>("Condition").value()->current_value();
+    bool condition = input_socket<bool>(CONDITION)->current_value();
 
-    int value = get_input_socket<int>("Value").value()->current_value();
-    auto out = get_output_socket<int>("Value").value();
+    int value = input_socket<int>(VALUE)->current_value();
+    auto out = output_socket<int>(RESULT);
 
     if (condition) {
       out->set_current_value(value + 1);
@@ -218,4 +495,8 @@ public:
   ConstantNode() { add_output_socket<int>("Output").with_default_value(0); }
   void execute() override {};
 };
+
+template <> struct Relocatable<MathNode> : std::true_type {};
+template <> struct Relocatable<IncrNode> : std::true_type {};
+template <> struct Relocatable<ConstantNode> : std::true_type {};
 } // namespace qgraph
@@ -0,0 +1,1125 @@
+#pragma once
+
+#include "QGraph/qgraph.hh"
+#include "QGraph/qlink.hh"
+#include "QGraph/qstop.hh"
+#include "QGraph/qtopology.hh"
+#include "QGraph/qtypes.hh"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <optional>
+#include <queue>
+#include <ranges>
+#include <signal.h>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <unistd.h>
+#include <vector>
+
+namespace qgraph {
+
+using PartitionId = std::uint16_t;
+
+/// Assignment of every node of a graph to one of `num_parts` parts.
+struct Partition {
+  size_t num_parts = 0;
+  // Part of every node, indexed by node id.
+  std::vector<PartitionId> part_of;
+  // Number of links whose endpoints live in different parts.
+  size_t cut_links = 0;
+
+  size_t size_of(PartitionId part) const {
+    return std::ranges::count(part_of, part);
+  };
+};
+
+/// Splits the nodes of `topology` into `num_parts` parts of similar
+/// size (within `imbalance` of the average) while keeping as few links
+/// as possible between different parts.
+///
+/// Parts are first grown one at a time from a seed node, always adding
+/// the node with the most links into the part and the fewest links to
+/// nodes not yet assigned. They are then refined by greedily moving
+/// every node to the part most of its neighbors live in, as long as
+/// sizes stay balanced.
+inline Partition partition(const Topology &topology, size_t num_parts,
+                           double imbalance = 0.1) {
+  if (num_parts == 0 ||
+      num_parts > std::numeric_limits<PartitionId>::max()) {
+    throw std::invalid_argument("Invalid number of partitions " +
+                                std::to_string(num_parts));
+  }
+
+  const size_t n = topology.num_of_nodes();
+
+  Partition result;
+  result.num_parts = num_parts;
+  result.part_of.assign(n, 0);
+
+  // Undirected adjacency, one entry per link end.
+  std::vector<std::vector<NodeId>> adjacent(n);
+  for (NodeId id = 0; id < n; ++id) {
+    for (const auto &link : topology.links_of(id)) {
+      adjacent[id].push_back(link.destination_node);
+      adjacent[link.destination_node].push_back(id);
+    }
+  }
+
+  // Grow every part from a seed, always adding the unassigned node with
+  // the most links into the part and the fewest to unassigned nodes.
+  constexpr auto unassigned = std::numeric_limits<PartitionId>::max();
+  std::ranges::fill(result.part_of, unassigned);
+
+  std::vector<size_t> sizes(num_parts, 0);
+  std::vector<long> gain(n, 0);
+  std::vector<size_t> rank(n, 0);
+  for (size_t i = 0; i < n; ++i) {
+    rank[topology.order[i]] = i;
+    gain[i] = -static_cast<long>(adjacent[i].size());
+  }
+
+  size_t assigned = 0;
+  size_t next_seed = 0;
+
+  for (PartitionId part = 0; part < num_parts; ++part) {
+    const size_t target = size_t{part} + 1 == num_parts
+                              ? n - assigned
+                              : (n - assigned) / (num_parts - part);
+
+    // Max heap on gain, ties broken by evaluation order.
+    std::priority_queue<std::pair<long, long>> frontier;
+
+    while (sizes[part] < target) {
+      if (frontier.empty()) {
+        while (result.part_of[topology.order[next_seed]] != unassigned) {
+          next_seed++;
+        }
+        auto seed = topology.order[next_seed];
+        frontier.emplace(gain[seed], -static_cast<long>(rank[seed]));
+      }
+
+      auto [node_gain, node_rank] = frontier.top();
+      frontier.pop();
+      auto node = topology.order[-node_rank];
+
+      if (result.part_of[node] != unassigned || node_gain != gain[node]) {
+        continue; // Stale entry.
+      }
+
+      result.part_of[node] = part;
+      sizes[part]++;
+      assigned++;
+
+      for (auto next : adjacent[node]) {
+        if (result.part_of[next] == unassigned) {
+          gain[next] += 2;
+          frontier.emplace(gain[next], -static_cast<long>(rank[next]));
+        }
+      }
+    }
+
+    // Nodes left on the frontier are no longer next to the part.
+    for (NodeId id = 0; id < n; ++id) {
+      if (result.part_of[id] == unassigned) {
+        gain[id] = 0;
+        for (auto next : adjacent[id]) {
+          gain[id] += result.part_of[next] == unassigned ? -1 : 0;
+        }
+      }
+    }
+  }
+
+  const double average = static_cast<double>(n) / num_parts;
+  const auto max_size =
+      static_cast<size_t>(std::ceil(average * (1 + imbalance)));
+  const auto min_size =
+      static_cast<size_t>(std::floor(average * (1 - imbalance)));
+
+  std::vector<size_t> neighbors_in(num_parts);
+  for (int pass = 0; pass < 8; ++pass) {
+    bool moved = false;
+
+    for (auto node : topology.order) {
+      std::ranges::fill(neighbors_in, 0);
+      for (auto next : adjacent[node]) {
+        neighbors_in[result.part_of[next]]++;
+      }
+
+      auto from = result.part_of[node];
+      auto best = from;
+      for (PartitionId part = 0; part < num_parts; ++part) {
+        if (neighbors_in[part] > neighbors_in[best] &&
+            sizes[part] + 1 <= max_size && sizes[from] - 1 >= min_size) {
+          best = part;
+        }
+      }
+
+      if (best != from) {
+        result.part_of[node] = best;
+        sizes[from]--;
+        sizes[best]++;
+        moved = true;
+      }
+    }
+
+    if (!moved) {
+      break;
+    }
+  }
+
+  for (NodeId id = 0; id < n; ++id) {
+    for (const auto &link : topology.links_of(id)) {
+      if (result.part_of[id] != result.part_of[link.destination_node]) {
+        result.cut_links++;
+      }
+    }
+  }
+
+  return result;
+};
+
+/// Single producer, single consumer queue of messages living in memory
+/// shared between processes. Lock free: both sides synchronize only
+/// through the head and tail counters. Messages larger than a slot are
+/// split over consecutive slots by `push` and joined by `consume`.
+class SharedRing {
+public:
+  struct Message {
+    std::uint32_t key;
+    std::uint32_t size;
+    // False if the message continues in the next slot.
+    bool last;
+
+    const void *data() const { return this + 1; };
+  };
+
+private:
+  struct Header {
+    alignas(64) std::atomic<std::uint64_t> head;
+    alignas(64) std::atomic<std::uint64_t> tail;
+    std::uint32_t capacity;
+    std::uint32_t slot_size;
+  };
+
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                "Shared rings require lock free 64 bit atomics");
+
+  Header *header_ = nullptr;
+  std::byte *slots_ = nullptr;
+  // Parts of a split message read so far. Local to the consumer.
+  std::vector<std::byte> joined_;
+
+  static size_t slot_size_for(size_t payload) {
+    return (sizeof(Message) + payload + 7) / 8 * 8;
+  };
+
+  Message *slot(std::uint64_t index) const {
+    return reinterpret_cast<Message *>(
+        slots_ + (index & (header_->capacity - 1)) * header_->slot_size);
+  };
+
+public:
+  SharedRing() = default;
+
+  // Bytes of shared memory taken by a ring able to hold `capacity`
+  // messages of up to `payload` bytes. `capacity` is rounded up to a
+  // power of two.
+  static size_t bytes_needed(size_t capacity, size_t payload) {
+    return sizeof(Header) + std::bit_ceil(capacity) * slot_size_for(payload);
+  };
+
+  // Constructs an empty ring at `memory`, which must be 64 byte
+  // aligned and hold at least `bytes_needed(capacity, payload)` bytes.
+  static SharedRing create(void *memory, size_t capacity, size_t payload) {
+    SharedRing ring;
+    ring.header_ = new (memory) Header{};
+    ring.header_->capacity =
+        static_cast<std::uint32_t>(std::bit_ceil(capacity));
+    ring.header_->slot_size =
+        static_cast<std::uint32_t>(slot_size_for(payload));
+    ring.slots_ = static_cast<std::byte *>(memory) + sizeof(Header);
+    return ring;
+  };
+
+  bool valid() const { return header_ != nullptr; };
+
+  // Largest message that fits in a single slot.
+  size_t slot_payload() const { return header_->slot_size - sizeof(Message); };
+
+  // Copies `size` bytes from `data` into the ring.
+  // Returns false if the ring is full.
+  bool try_push(std::uint32_t key, const void *data, size_t size,
+                bool last = true) {
+    if (size > slot_payload()) {
+      throw std::length_error("Message does not fit in a ring slot");
+    }
+
+    auto head = header_->head.load(std::memory_order_relaxed);
+    if (head - header_->tail.load(std::memory_order_acquire) ==
+        header_->capacity) {
+      return false;
+    }
+
+    auto message = slot(head);
+    message->key = key;
+    message->size = static_cast<std::uint32_t>(size);
+    message->last = last;
+    if (size > 0) {
+      std::memcpy(message + 1, data, size);
+    }
+
+    header_->head.store(head + 1, std::memory_order_release);
+    return true;
+  };
+
+  // Oldest message in the ring, or null if it is empty. The message
+  // stays valid until `pop()` is called.
+  const Message *front() const {
+    auto tail = header_->tail.load(std::memory_order_relaxed);
+    if (tail == header_->head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return slot(tail);
+  };
+
+  void pop() {
+    header_->tail.store(header_->tail.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_release);
+  };
+
+  // Copies `size` bytes from `data` into the ring, split over as many
+  // slots as needed. Calls `wait()` while the ring is full, so the
+  // consumer must be draining it meanwhile.
+  template <typename Wait>
+  void push(std::uint32_t key, const void *data, size_t size, Wait &&wait) {
+    auto bytes = static_cast<const std::byte *>(data);
+    do {
+      auto part = std::min(size, slot_payload());
+      while (!try_push(key, bytes, part, part == size)) {
+        wait();
+      }
+      bytes += part;
+      size -= part;
+    } while (size > 0);
+  };
+
+  // Calls `handle(key, data, size)` with the oldest message, joined if
+  // it was split, and removes it. Returns false if the ring is empty.
+  // Calls `wait()` while the rest of a split message is not there yet.
+  template <typename Handle, typename Wait>
+  bool consume(Handle &&handle, Wait &&wait) {
+    auto message = front();
+    if (message == nullptr) {
+      return false;
+    }
+
+    if (message->last) {
+      handle(message->key, message->data(), message->size);
+      pop();
+      return true;
+    }
+
+    joined_.clear();
+    auto key = message->key;
+    while (true) {
+      auto data = static_cast<const std::byte *>(message->data());
+      joined_.insert(joined_.end(), data, data + message->size);
+      bool last = message->last;
+      pop();
+      if (last) {
+        break;
+      }
+      while ((message = front()) == nullptr) {
+        wait();
+      }
+    }
+
+    handle(key, joined_.data(), joined_.size());
+    return true;
+  };
+};
+
+/// Evaluates a graph split across several worker processes.
+///
+/// The graph is partitioned with `partition()` and every part is
+/// evaluated by a worker process forked from the calling one, so a
+/// crash in one part cannot take down the caller. Values travel through
+/// lock free rings in shared memory: trivially copyable values are
+/// copied bytewise, other values through their `Serializer`. Every
+/// socket feeding a link between parts must hold a value of either kind.
+///
+/// Workers start from a copy of the graph as it is when the evaluator
+/// is constructed, and do not see later changes to its topology. Before
+/// every evaluation, the values of the sockets written in the calling
+/// process since the previous one are sent to the workers, and
+/// afterwards the output values computed by the workers are copied
+/// back into the graph. Outputs whose values can be sent neither way
+/// stay as they were, and writing such a socket in the calling process
+/// makes the next evaluation throw.
+///
+/// Workers are forked, so the evaluator should be created before the
+/// calling process starts other threads.
+class PartitionedEvaluator {
+private:
+  struct Control {
+    alignas(64) std::atomic<std::uint64_t> generation;
+    alignas(64) std::atomic<bool> stop;
+    // Deadline of the current generation, in steady clock ticks, which
+    // are shared by every process of the machine.
+    std::atomic<std::int64_t> deadline;
+    // Whether a stop was requested through the token of the current
+    // generation.
+    std::atomic<bool> cancelled;
+  };
+
+  // What a node did in the current generation, see `node_states_`.
+  enum NodeState : std::uint8_t { SKIPPED, COMPLETED, INTERRUPTED };
+
+  struct WorkerState {
+    alignas(64) std::atomic<std::uint64_t> done;
+    // Peak resident memory in bytes, published along with `done`.
+    std::uint64_t peak_memory;
+  };
+
+  struct CutLink {
+    NodeId source_node;
+    Link link;
+  };
+
+  // Value written in the calling process, waiting to be sent.
+  struct Outgoing {
+    PartitionId part;
+    std::uint32_t key;
+    size_t offset;
+    size_t size;
+  };
+
+  // Spins, then yields, then sleeps while waiting on shared memory.
+  class Backoff {
+  private:
+    unsigned spins_ = 0;
+
+  public:
+    void operator()() {
+      if (++spins_ < 64) {
+        return;
+      } else if (spins_ < 256) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+    };
+  };
+
+  static constexpr std::uint32_t local_link =
+      std::numeric_limits<std::uint32_t>::max();
+  // Key closing the values sent to a worker before an evaluation.
+  static constexpr std::uint32_t end_of_inputs =
+      std::numeric_limits<std::uint32_t>::max();
+  // Set in the key of a value along a cut link whose source node did
+  // not complete. Only counts as arrived, the value is not sent.
+  static constexpr std::uint32_t not_sent = 1u << 31;
+  // Slot size for serialized values. Larger ones span several slots.
+  static constexpr size_t serialized_payload = 256;
+  // Weight given to the newest measurement in `node_costs_`.
+  static constexpr double smoothing = 0.25;
+
+  Graph &graph_;
+  Topology topology_;
+  Partition partition_;
+  std::vector<CutLink> cut_links_;
+  // Index in `cut_links_` of every link, or `local_link`, with the
+  // same layout as `topology_.links`.
+  std::vector<std::vector<std::uint32_t>> cut_index_;
+  // Number of cut links feeding every node.
+  std::vector<size_t> incoming_cuts_;
+
+  // Sockets are numbered node by node, inputs first, from
+  // `first_socket_[id]` on. Messages about a single socket use this
+  // number as key.
+  std::vector<std::uint32_t> first_socket_;
+  // Version of every socket when its value was last exchanged with
+  // the workers.
+  std::vector<std::uint64_t> versions_;
+  // Whether the value of every socket can be sent between processes.
+  std::vector<bool> sendable_;
+
+  void *memory_ = MAP_FAILED;
+  size_t memory_size_ = 0;
+  Control *control_ = nullptr;
+  WorkerState *workers_state_ = nullptr;
+  // Smoothed `execute()` time of every node in nanoseconds, negative
+  // if never measured. Written by the worker running the node.
+  double *node_costs_ = nullptr;
+  // `NodeState` of every node in the last generation. Written by the
+  // worker running the node before it reports the generation done.
+  std::uint8_t *node_states_ = nullptr;
+  // Ring from part `a` to part `b` at `a * (num_parts + 1) + b`. The
+  // calling process sends and receives as part `num_parts`.
+  std::vector<SharedRing> rings_;
+
+  std::vector<pid_t> workers_;
+  std::uint64_t generation_ = 0;
+  bool failed_ = false;
+
+  // Local to each process.
+  std::vector<size_t> arrived_;
+  std::vector<std::byte> scratch_;
+  std::vector<Outgoing> outgoing_;
+  std::vector<std::byte> outgoing_bytes_;
+
+  SharedRing &ring(size_t from, size_t to) {
+    return rings_[from * (num_parts() + 1) + to];
+  };
+
+  static size_t align(size_t bytes) { return (bytes + 63) / 64 * 64; };
+
+  template <typename F> void for_each_socket(NodeId id, F &&f) const {
+    const auto &node = *topology_.nodes[id];
+    auto key = first_socket_[id];
+    for (const auto &socket : node.input_sockets()) {
+      f(key++, *socket);
+    }
+    for (const auto &socket : node.output_sockets()) {
+      f(key++, *socket);
+    }
+  };
+
+  Socket &socket_at(std::uint32_t key) const {
+    auto next =
+        std::upper_bound(first_socket_.begin(), first_socket_.end(), key);
+    auto id = static_cast<NodeId>(next - first_socket_.begin() - 1);
+    const auto &node = *topology_.nodes[id];
+
+    auto index = key - first_socket_[id];
+    auto inputs = node.input_sockets().size();
+    return index < inputs ? *node.input_sockets()[index]
+                          : *node.output_sockets()[index - inputs];
+  };
+
+  // Bytes of the current value of `socket`, serialized into `scratch_`
+  // unless it can be copied as it is. Empty if neither is possible.
+  std::optional<std::span<const std::byte>> value_bytes(const Socket &socket) {
+    if (auto size = socket.trivial_value_size()) {
+      auto data = static_cast<const std::byte *>(socket.current_value_data());
+      return std::span(data, size);
+    }
+
+    scratch_.clear();
+    if (!socket.save_current_value(scratch_)) {
+      return std::nullopt;
+    }
+    return std::span<const std::byte>(scratch_);
+  };
+
+  static void load_value_bytes(Socket &socket, const void *data,
+                               size_t size) {
+    if (socket.trivial_value_size() != 0) {
+      std::memcpy(socket.mutable_current_value_data(), data, size);
+    } else {
+      socket.load_current_value(static_cast<const std::byte *>(data), size);
+    }
+  };
+
+  // Largest slot payload needed to send the value of `socket`.
+  std::optional<size_t> payload_of(const Socket &socket) {
+    if (auto size = socket.trivial_value_size()) {
+      return size;
+    }
+    if (value_bytes(socket)) {
+      return serialized_payload;
+    }
+    return std::nullopt;
+  };
+
+  void plan() {
+    const size_t n = topology_.num_of_nodes();
+    const size_t parts = num_parts();
+
+    std::vector<size_t> messages((parts + 1) * (parts + 1), 0);
+    std::vector<size_t> payload((parts + 1) * (parts + 1), 0);
+    auto count = [&](size_t from, size_t to, size_t size) {
+      messages[from * (parts + 1) + to]++;
+      payload[from * (parts + 1) + to] =
+          std::max(payload[from * (parts + 1) + to], size);
+    };
+
+    first_socket_.assign(n + 1, 0);
+    for (NodeId id = 0; id < n; ++id) {
+      const auto &node = *topology_.nodes[id];
+      auto sockets = node.input_sockets().size() + node.output_sockets().size();
+      if (first_socket_[id] + sockets >= end_of_inputs) {
+        throw std::length_error("Too many sockets to partition the graph");
+      }
+      first_socket_[id + 1] =
+          first_socket_[id] + static_cast<std::uint32_t>(sockets);
+    }
+    versions_.assign(first_socket_[n], 0);
+    sendable_.assign(first_socket_[n], false);
+
+    cut_index_.resize(n);
+    incoming_cuts_.assign(n, 0);
+
+    for (NodeId id = 0; id < n; ++id) {
+      auto from = partition_.part_of[id];
+
+      for (const auto &link : topology_.links_of(id)) {
+        auto to = partition_.part_of[link.destination_node];
+
+        if (from == to) {
+          cut_index_[id].push_back(local_link);
+          continue;
+        }
+
+        auto &node = *topology_.nodes[id];
+        auto size =
+            payload_of(*node.get_untyped_output_socket(link.source_socket));
+        if (!size) {
+          throw std::invalid_argument(
+              "Link from node " + std::to_string(id) +
+              " crosses partitions but its value is neither trivially "
+              "copyable nor has a qgraph::Serializer");
+        }
+
+        if (cut_links_.size() >= not_sent) {
+          throw std::length_error("Too many links between partitions");
+        }
+        cut_index_[id].push_back(static_cast<std::uint32_t>(cut_links_.size()));
+        cut_links_.push_back({id, link});
+        incoming_cuts_[link.destination_node]++;
+        count(from, to, *size);
+      }
+
+      // Values written by the calling process go to the worker, and
+      // outputs come back.
+      auto outputs = first_socket_[id] +
+                     topology_.nodes[id]->input_sockets().size();
+      for_each_socket(id, [&](std::uint32_t key, const Socket &socket) {
+        versions_[key] = socket.version();
+        if (auto size = payload_of(socket)) {
+          sendable_[key] = true;
+          count(parts, from, *size);
+          if (key >= outputs) {
+            count(from, parts, *size);
+          }
+        }
+      });
+    }
+
+    for (size_t part = 0; part < parts; ++part) {
+      count(parts, part, 0);
+    }
+
+    // Rings hold all the messages of one evaluation, so that producers
+    // rarely wait for consumers.
+    memory_size_ = align(sizeof(Control)) +
+                   parts * align(sizeof(WorkerState)) +
+                   align(n * sizeof(double)) + align(n);
+    for (size_t i = 0; i < messages.size(); ++i) {
+      if (messages[i] > 0) {
+        memory_size_ +=
+            align(SharedRing::bytes_needed(messages[i], payload[i]));
+      }
+    }
+
+    memory_ = mmap(nullptr, memory_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory_ == MAP_FAILED) {
+      throw std::system_error(errno, std::generic_category(),
+                              "Cannot map shared memory for partitions");
+    }
+
+    auto cursor = static_cast<std::byte *>(memory_);
+    control_ = new (cursor) Control{};
+    cursor += align(sizeof(Control));
+
+    workers_state_ = reinterpret_cast<WorkerState *>(cursor);
+    for (size_t part = 0; part < parts; ++part) {
+      new (cursor) WorkerState{};
+      cursor += align(sizeof(WorkerState));
+    }
+
+    node_costs_ = reinterpret_cast<double *>(cursor);
+    std::fill_n(node_costs_, n, -1.0);
+    cursor += align(n * sizeof(double));
+
+    node_states_ = reinterpret_cast<std::uint8_t *>(cursor);
+    std::fill_n(node_states_, n, SKIPPED);
+    cursor += align(n);
+
+    rings_.resize(messages.size());
+    for (size_t i = 0; i < messages.size(); ++i) {
+      if (messages[i] > 0) {
+        rings_[i] = SharedRing::create(cursor, messages[i], payload[i]);
+        cursor += align(SharedRing::bytes_needed(messages[i], payload[i]));
+      }
+    }
+  };
+
+  void launch() {
+    for (PartitionId part = 0; part < num_parts(); ++part) {
+      pid_t pid = fork();
+
+      if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        int status = 0;
+        try {
+          serve(part);
+        } catch (...) {
+          status = 1;
+        }
+        _exit(status);
+      } else if (pid < 0) {
+        auto error = errno;
+        shutdown();
+        throw std::system_error(error, std::generic_category(),
+                                "Cannot start partition worker");
+      }
+
+      workers_.push_back(pid);
+    }
+  };
+
+  void shutdown() {
+    if (control_ != nullptr) {
+      control_->stop.store(true, std::memory_order_release);
+    }
+
+    for (auto pid : workers_) {
+      if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+      }
+    }
+    workers_.clear();
+
+    if (memory_ != MAP_FAILED) {
+      munmap(memory_, memory_size_);
+      memory_ = MAP_FAILED;
+      control_ = nullptr;
+      workers_state_ = nullptr;
+      node_costs_ = nullptr;
+      node_states_ = nullptr;
+    }
+  };
+
+  // Applies every value sent to `part` by other workers.
+  // Returns whether any was received.
+  bool receive(PartitionId part) {
+    bool received = false;
+    Backoff wait;
+
+    for (size_t from = 0; from < num_parts(); ++from) {
+      auto &inbox = ring(from, part);
+      if (!inbox.valid()) {
+        continue;
+      }
+
+      auto apply = [&](std::uint32_t key, const void *data, size_t size) {
+        if (key & not_sent) {
+          arrived_[cut_links_[key & ~not_sent].link.destination_node]++;
+          return;
+        }
+
+        const auto &cut = cut_links_[key];
+        auto output = topology_.nodes[cut.source_node]
+                          ->get_untyped_output_socket(cut.link.source_socket);
+        load_value_bytes(*output, data, size);
+
+        const auto &destination = topology_.nodes[cut.link.destination_node];
+        auto input =
+            destination->get_untyped_input_socket(cut.link.destination_socket);
+        transfer_value(cut.link, *output, *input);
+
+        arrived_[cut.link.destination_node]++;
+      };
+
+      while (inbox.consume(apply, wait)) {
+        received = true;
+      }
+    }
+
+    return received;
+  };
+
+  // Sends `size` bytes from worker `part`. Values sent to `part` are
+  // received while `outbox` is full, so that workers never wait on
+  // each other.
+  void send(PartitionId part, SharedRing &outbox, std::uint32_t key,
+            const void *data, size_t size) {
+    Backoff wait;
+    outbox.push(key, data, size, [&] {
+      if (stopping()) {
+        throw std::runtime_error("Partitioned evaluator stopped");
+      }
+      if (!receive(part)) {
+        wait();
+      }
+    });
+  };
+
+  void send(PartitionId part, SharedRing &outbox, std::uint32_t key,
+            const Socket &socket) {
+    auto bytes = value_bytes(socket);
+    if (!bytes) {
+      throw std::logic_error("Socket value cannot be sent");
+    }
+    send(part, outbox, key, bytes->data(), bytes->size());
+  };
+
+  bool stopping() const {
+    return control_->stop.load(std::memory_order_acquire);
+  };
+
+  // Applies the values sent by the calling process to `part`. Returns
+  // false if asked to stop meanwhile.
+  bool receive_inputs(PartitionId part) {
+    auto &inbox = ring(num_parts(), part);
+    bool complete = false;
+    auto apply = [&](std::uint32_t key, const void *data, size_t size) {
+      if (key == end_of_inputs) {
+        complete = true;
+      } else {
+        load_value_bytes(socket_at(key), data, size);
+      }
+    };
+
+    Backoff wait;
+    while (!complete) {
+      if (stopping()) {
+        return false;
+      }
+      if (!inbox.consume(apply, wait)) {
+        wait();
+      }
+    }
+    return true;
+  };
+
+  // Worker process loop.
+  void serve(PartitionId part) {
+    std::vector<NodeId> nodes;
+    for (auto id : topology_.order) {
+      if (partition_.part_of[id] == part) {
+        nodes.push_back(id);
+      }
+    }
+
+    arrived_.assign(topology_.num_of_nodes(), 0);
+    std::uint64_t seen = 0;
+
+    while (true) {
+      Backoff wait;
+      while (control_->generation.load(std::memory_order_acquire) == seen) {
+        if (stopping()) {
+          return;
+        }
+        wait();
+      }
+      seen = control_->generation.load(std::memory_order_acquire);
+      std::ranges::fill(arrived_, 0);
+
+      if (!receive_inputs(part)) {
+        return;
+      }
+
+      // Token cancellation is forwarded by the calling process through
+      // `cancelled`.
+      StopCondition stop;
+      stop.deadline = StopCondition::Clock::time_point(
+          StopCondition::Clock::duration(
+              control_->deadline.load(std::memory_order_relaxed)));
+      StopScope scope(stop, &control_->cancelled);
+      bool stopped = false;
+
+      for (auto id : nodes) {
+        Backoff wait_inputs;
+        while (arrived_[id] < incoming_cuts_[id]) {
+          if (stopping()) {
+            return;
+          }
+          if (!receive(part)) {
+            wait_inputs();
+          }
+        }
+
+        const auto &node = topology_.nodes[id];
+        stopped = stopped || active_stop.reached();
+        node_states_[id] = SKIPPED;
+
+        if (!stopped) {
+          auto start = std::chrono::steady_clock::now();
+          bool ran = run_to_end(*node);
+          auto end = std::chrono::steady_clock::now();
+
+          auto elapsed = std::chrono::duration<double, std::nano>(end - start);
+          auto &cost = node_costs_[id];
+          cost = cost < 0 ? elapsed.count()
+                          : smoothing * elapsed.count() +
+                                (1 - smoothing) * cost;
+
+          stopped = !ran;
+          node_states_[id] = ran ? COMPLETED : INTERRUPTED;
+        }
+
+        // Nodes that did not complete still tell other parts, so that
+        // those do not wait for them.
+        const auto &links = topology_.links_of(id);
+        for (size_t i = 0; i < links.size(); ++i) {
+          auto output = node->get_untyped_output_socket(links[i].source_socket);
+
+          if (node_states_[id] != COMPLETED) {
+            if (cut_index_[id][i] != local_link) {
+              auto to = partition_.part_of[links[i].destination_node];
+              send(part, ring(part, to), cut_index_[id][i] | not_sent,
+                   nullptr, 0);
+            }
+          } else if (cut_index_[id][i] == local_link) {
+            auto input = topology_.nodes[links[i].destination_node]
+                             ->get_untyped_input_socket(
+                                 links[i].destination_socket);
+            transfer_value(links[i], *output, *input);
+          } else {
+            auto to = partition_.part_of[links[i].destination_node];
+            send(part, ring(part, to), cut_index_[id][i], *output);
+          }
+        }
+      }
+
+      // Hand the outputs back to the calling process.
+      for (auto id : nodes) {
+        if (node_states_[id] == SKIPPED) {
+          continue;
+        }
+        auto outputs =
+            first_socket_[id] + topology_.nodes[id]->input_sockets().size();
+        for_each_socket(id, [&](std::uint32_t key, const Socket &socket) {
+          if (key >= outputs && sendable_[key]) {
+            send(part, ring(part, num_parts()), key, socket);
+          }
+        });
+      }
+
+      rusage usage{};
+      getrusage(RUSAGE_SELF, &usage);
+      // Kilobytes on Linux.
+      workers_state_[part].peak_memory =
+          static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+      workers_state_[part].done.store(seen, std::memory_order_release);
+    }
+  };
+
+  // Waits for workers, throwing if one of them has died.
+  void wait_for_workers(Backoff &wait) {
+    check_workers();
+    wait();
+  };
+
+  bool collect_results() {
+    bool received = false;
+    Backoff wait;
+    auto apply = [&](std::uint32_t key, const void *data, size_t size) {
+      load_value_bytes(socket_at(key), data, size);
+    };
+
+    for (size_t part = 0; part < num_parts(); ++part) {
+      auto &inbox = ring(part, num_parts());
+      if (!inbox.valid()) {
+        continue;
+      }
+
+      while (inbox.consume(apply, [&] { wait_for_workers(wait); })) {
+        received = true;
+      }
+    }
+
+    return received;
+  };
+
+  // Gathers the values written since the last evaluation. Throws,
+  // before anything is sent, if one of them cannot be sent.
+  void stage_inputs() {
+    outgoing_.clear();
+    outgoing_bytes_.clear();
+
+    for (NodeId id = 0; id < topology_.num_of_nodes(); ++id) {
+      for_each_socket(id, [&](std::uint32_t key, const Socket &socket) {
+        if (socket.version() == versions_[key]) {
+          return;
+        }
+
+        auto bytes = sendable_[key] ? value_bytes(socket) : std::nullopt;
+        if (!bytes) {
+          throw std::invalid_argument(
+              "A socket of node " + std::to_string(id) +
+              " was written but its value is neither trivially copyable "
+              "nor has a qgraph::Serializer");
+        }
+
+        outgoing_.push_back({partition_.part_of[id], key,
+                             outgoing_bytes_.size(), bytes->size()});
+        outgoing_bytes_.insert(outgoing_bytes_.end(), bytes->begin(),
+                               bytes->end());
+      });
+    }
+  };
+
+  void send_inputs() {
+    Backoff wait;
+    auto full = [&] { wait_for_workers(wait); };
+
+    for (PartitionId part = 0; part < num_parts(); ++part) {
+      auto &outbox = ring(num_parts(), part);
+      for (const auto &value : outgoing_) {
+        if (value.part == part) {
+          outbox.push(value.key, outgoing_bytes_.data() + value.offset,
+                      value.size, full);
+        }
+      }
+      outbox.push(end_of_inputs, nullptr, 0, full);
+    }
+  };
+
+  void check_workers() {
+    for (size_t part = 0; part < workers_.size(); ++part) {
+      int status = 0;
+      if (workers_[part] > 0 &&
+          waitpid(workers_[part], &status, WNOHANG) == workers_[part]) {
+        workers_[part] = -1;
+        failed_ = true;
+        throw std::runtime_error("Worker for partition " +
+                                 std::to_string(part) + " exited");
+      }
+    }
+  };
+
+public:
+  PartitionedEvaluator(Graph &graph, size_t num_partitions)
+      : graph_(graph), topology_(Topology::of(graph)),
+        partition_(qgraph::partition(topology_, num_partitions)) {
+    plan();
+    launch();
+  };
+
+  PartitionedEvaluator(const PartitionedEvaluator &) = delete;
+  PartitionedEvaluator &operator=(const PartitionedEvaluator &) = delete;
+
+  ~PartitionedEvaluator() { shutdown(); };
+
+  const Partition &partition() const { return partition_; };
+
+  /// Sends the values written since the previous evaluation to the
+  /// workers, runs one evaluation on every worker and waits for all of
+  /// them. Throws, without evaluating, if a written value cannot be
+  /// sent. Throws if a worker process has died, after which the
+  /// evaluator cannot be used anymore.
+  ///
+  /// Workers stop starting nodes once `stop` is reached, like
+  /// `Evaluator::evaluate`, and nodes see both the deadline and the
+  /// token through `Node::stop_requested`. Outputs of the nodes that
+  /// ran are copied back, those of interrupted nodes included. Nodes
+  /// are listed in the returned status in topological order.
+  EvaluationStatus evaluate(const StopCondition &stop = {}) {
+    if (failed_) {
+      throw std::runtime_error("A partition worker has failed");
+    }
+
+    stage_inputs();
+
+    generation_++;
+    control_->deadline.store(stop.deadline.time_since_epoch().count(),
+                             std::memory_order_relaxed);
+    control_->cancelled.store(stop.cancelled(), std::memory_order_relaxed);
+    control_->generation.store(generation_, std::memory_order_release);
+    send_inputs();
+
+    Backoff wait;
+    while (true) {
+      if (stop.cancelled()) {
+        control_->cancelled.store(true, std::memory_order_release);
+      }
+
+      bool received = collect_results();
+
+      size_t finished = 0;
+      for (size_t part = 0; part < num_parts(); ++part) {
+        if (workers_state_[part].done.load(std::memory_order_acquire) ==
+            generation_) {
+          finished++;
+        }
+      }
+
+      if (finished == num_parts()) {
+        collect_results();
+        break;
+      }
+
+      if (!received) {
+        wait_for_workers(wait);
+      }
+    }
+
+    // Values received from the workers are not sent back.
+    for (NodeId id = 0; id < topology_.num_of_nodes(); ++id) {
+      for_each_socket(id, [&](std::uint32_t key, const Socket &socket) {
+        versions_[key] = socket.version();
+      });
+    }
+
+    EvaluationStatus status;
+    status.completed.reserve(topology_.order.size());
+    for (auto id : topology_.order) {
+      if (node_states_[id] == COMPLETED) {
+        status.completed.push_back(id);
+      } else if (node_states_[id] == INTERRUPTED) {
+        status.interrupted.push_back(id);
+      }
+    }
+
+    if (status.completed.size() < topology_.order.size()) {
+      status.outcome = stop.cancelled() ? EvaluationStatus::CANCELLED
+                                        : EvaluationStatus::DEADLINE_EXCEEDED;
+    }
+    return status;
+  };
+
+  /// Number of parts, each evaluated by its own worker process.
+  size_t num_parts() const { return partition_.num_parts; };
+
+  /// Smoothed `execute()` time of a node in nanoseconds, as measured by
+  /// the worker running it, or a negative value if it has not run yet.
+  double node_cost(NodeId node) const {
+    return node_costs_ != nullptr && node < topology_.num_of_nodes()
+               ? node_costs_[node]
+               : -1.0;
+  };
+
+  /// Peak resident memory, in bytes, of the worker evaluating `part` as
+  /// of its last evaluation. Zero before the first one.
+  size_t peak_memory(PartitionId part) const {
+    if (part >= num_parts() || workers_state_ == nullptr) {
+      throw std::out_of_range("Partition " + std::to_string(part) +
+                              " is out of range");
+    }
+    return workers_state_[part].peak_memory;
+  };
+};
+
+} // namespace qgraph
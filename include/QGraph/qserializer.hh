@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace qgraph {
+
+/// Converts socket values of type `T` to and from bytes, used to
+/// checkpoint values that are not trivially copyable. Register a
+/// serializer for a custom type by specializing this template:
+///
+///     template <> struct qgraph::Serializer<MyType> {
+///       static void save(const MyType &value, std::vector<std::byte> &out);
+///       static void load(MyType &value, const std::byte *data, size_t size);
+///     };
+///
+/// `save` appends the bytes of `value` to `out`; `load` receives
+/// exactly the bytes appended by `save`.
+template <typename T> struct Serializer;
+
+template <typename T>
+concept Serializable = requires(const T &value, T &target,
+                                std::vector<std::byte> &out,
+                                const std::byte *data, std::size_t size) {
+  Serializer<T>::save(value, out);
+  Serializer<T>::load(target, data, size);
+};
+
+template <> struct Serializer<std::string> {
+  static void save(const std::string &value, std::vector<std::byte> &out) {
+    auto bytes = reinterpret_cast<const std::byte *>(value.data());
+    out.insert(out.end(), bytes, bytes + value.size());
+  };
+
+  static void load(std::string &value, const std::byte *data,
+                   std::size_t size) {
+    value.assign(reinterpret_cast<const char *>(data), size);
+  };
+};
+
+// `std::vector<bool>` packs its elements and has no `data()`, see the
+// specialization below.
+template <typename T>
+  requires std::is_trivially_copyable_v<T> && (!std::is_same_v<T, bool>)
+struct Serializer<std::vector<T>> {
+  static void save(const std::vector<T> &value, std::vector<std::byte> &out) {
+    auto bytes = reinterpret_cast<const std::byte *>(value.data());
+    out.insert(out.end(), bytes, bytes + value.size() * sizeof(T));
+  };
+
+  static void load(std::vector<T> &value, const std::byte *data,
+                   std::size_t size) {
+    value.resize(size / sizeof(T));
+    std::memcpy(value.data(), data, value.size() * sizeof(T));
+  };
+};
+
+// Saves one byte per element.
+template <> struct Serializer<std::vector<bool>> {
+  static void save(const std::vector<bool> &value,
+                   std::vector<std::byte> &out) {
+    for (bool element : value) {
+      out.push_back(static_cast<std::byte>(element));
+    }
+  };
+
+  static void load(std::vector<bool> &value, const std::byte *data,
+                   std::size_t size) {
+    value.resize(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      value[i] = data[i] != std::byte{0};
+    }
+  };
+};
+
+// Appends the bytes of `value` to `out`, copying trivially copyable
+// types as they are. Returns false if `T` cannot be serialized.
+template <typename T>
+bool save_value(const T &value, std::vector<std::byte> &out) {
+  if constexpr (std::is_trivially_copyable_v<T>) {
+    auto offset = out.size();
+    out.resize(offset + sizeof(T));
+    std::memcpy(out.data() + offset, &value, sizeof(T));
+    return true;
+  } else if constexpr (Serializable<T>) {
+    Serializer<T>::save(value, out);
+    return true;
+  } else {
+    return false;
+  }
+};
+
+template <typename T>
+bool load_value(T &value, const std::byte *data, std::size_t size) {
+  if constexpr (std::is_trivially_copyable_v<T>) {
+    if (size != sizeof(T)) {
+      throw std::invalid_argument(
+          "Saved value size does not match the socket type");
+    }
+    std::memcpy(&value, data, sizeof(T));
+    return true;
+  } else if constexpr (Serializable<T>) {
+    Serializer<T>::load(value, data, size);
+    return true;
+  } else {
+    return false;
+  }
+};
+
+} // namespace qgraph
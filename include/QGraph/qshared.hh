@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+
+namespace qgraph {
+
+/// Immutable, reference counted payload for large socket values.
+///
+/// Declaring a socket as `Shared<T>` instead of `T` makes every
+/// copy of its value (propagation, fan-out to many inputs, getters)
+/// a pointer copy. All consumers read the same allocation. A consumer
+/// that needs to modify its copy calls `mutate()`, which clones the
+/// payload first if anybody else still references it (copy-on-write).
+///
+/// Reading through any number of handles is safe from any thread.
+/// `mutate()` decides whether to clone from the reference count alone,
+/// so it is only safe while no other thread copies or drops handles
+/// to the same payload, e.g. between evaluations.
+template <typename T> class Shared {
+private:
+  std::shared_ptr<T> data_;
+
+public:
+  Shared() : data_(std::make_shared<T>()) {};
+  Shared(const T &value) : data_(std::make_shared<T>(value)) {};
+  Shared(T &&value) : data_(std::make_shared<T>(std::move(value))) {};
+
+  const T &get() const { return *data_; };
+  const T &operator*() const { return *data_; };
+  const T *operator->() const { return data_.get(); };
+
+  // Returns a writable reference to the payload, detaching
+  // this handle from any other handle sharing it.
+  T &mutate() {
+    if (data_.use_count() > 1) {
+      data_ = std::make_shared<T>(*data_);
+    }
+    return *data_;
+  };
+
+  // Number of handles currently sharing the payload.
+  long use_count() const { return data_.use_count(); };
+
+  bool shares_with(const Shared &other) const { return data_ == other.data_; };
+
+  bool operator==(const Shared &rhs) const {
+    return data_ == rhs.data_ || *data_ == *rhs.data_;
+  };
+};
+
+} // namespace qgraph
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "QGraph/qgraph.hh"
+#include "QGraph/qlink.hh"
+#include "QGraph/qnode.hh"
+#include "QGraph/qstop.hh"
+#include "QGraph/qtopology.hh"
+#include "QGraph/qtypes.hh"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace qgraph {
+
+/// Graph whose topology can be edited while it is being evaluated.
+///
+/// Every evaluation runs against the topology published when it
+/// started. Editors work on a private draft and publish it on commit;
+/// evaluations never wait for an edit to finish. Taking and publishing
+/// a version goes through `std::atomic<std::shared_ptr>`, which is not
+/// lock-free with common standard libraries: an evaluation starting
+/// while a commit publishes may wait for that pointer swap, but never
+/// for anything longer. A topology version is released as soon as the
+/// last evaluation using it ends.
+///
+/// Drafts share nodes, and the links of nodes an edit does not touch,
+/// with the published version. An edit therefore costs one pointer
+/// copy per node plus the links it changes, and commit only sorts the
+/// topology again when a new link runs against the current order.
+///
+/// Editors are serialized among themselves. Evaluations write socket
+/// values, so at most one evaluation should run at a time.
+class VersionedGraph {
+private:
+  std::atomic<std::shared_ptr<const Topology>> current_;
+  std::mutex editors_;
+
+public:
+  class Edit {
+  private:
+    VersionedGraph &graph_;
+    std::unique_lock<std::mutex> lock_;
+    Topology draft_;
+    // Whether the draft owns the lists of a node, which other versions
+    // then do not share and can be changed in place.
+    std::vector<bool> owns_links_;
+    std::vector<bool> owns_feeders_;
+    // Whether a new link runs against `draft_.order`.
+    bool unsorted_ = false;
+
+    void check_node(NodeId id) const {
+      if (id >= draft_.nodes.size()) {
+        throw std::out_of_range("Node ID is out of range.");
+      }
+    };
+
+    // Lists are only ever created non-const, so casting const away from
+    // those the draft owns is safe.
+    Topology::Links &own_links(NodeId id) {
+      if (!owns_links_[id]) {
+        draft_.links[id] = std::make_shared<Topology::Links>(*draft_.links[id]);
+        owns_links_[id] = true;
+      }
+      return const_cast<Topology::Links &>(*draft_.links[id]);
+    };
+
+    Topology::Feeders &own_feeders(NodeId id) {
+      if (!owns_feeders_[id]) {
+        draft_.feeders[id] =
+            std::make_shared<Topology::Feeders>(*draft_.feeders[id]);
+        owns_feeders_[id] = true;
+      }
+      return const_cast<Topology::Feeders &>(*draft_.feeders[id]);
+    };
+
+    NodeId feeder(NodeId to_node, SocketId at_in_socket) const {
+      const auto &feeding = *draft_.feeders[to_node];
+      return at_in_socket < feeding.size() ? feeding[at_in_socket]
+                                           : Topology::unconnected;
+    };
+
+    // Removes the link from `from_node` into the input, if any.
+    void unlink(NodeId from_node, NodeId to_node, SocketId at_in_socket) {
+      std::erase_if(own_links(from_node), [&](const Link &link) {
+        return link.destination_node == to_node &&
+               link.destination_socket == at_in_socket;
+      });
+      own_feeders(to_node)[at_in_socket] = Topology::unconnected;
+    };
+
+  public:
+    Edit(VersionedGraph &graph)
+        : graph_(graph), lock_(graph.editors_), draft_(*graph.snapshot()),
+          owns_links_(draft_.nodes.size(), false),
+          owns_feeders_(draft_.nodes.size(), false) {};
+
+    template <DerivesNode T, typename... Args> NodeId add_node(Args... args) {
+      auto id = static_cast<NodeId>(draft_.nodes.size());
+      draft_.nodes.emplace_back(
+          std::make_shared<T>(std::forward<Args>(args)...));
+      draft_.nodes.back()->set_id(id);
+      draft_.links.push_back(std::make_shared<Topology::Links>());
+      draft_.feeders.push_back(std::make_shared<Topology::Feeders>());
+      owns_links_.push_back(true);
+      owns_feeders_.push_back(true);
+      // Nothing feeds the node yet, so it can run last.
+      draft_.position.push_back(draft_.order.size());
+      draft_.order.push_back(id);
+      return id;
+    };
+
+    /// Links an output socket to an input socket, converting values
+    /// as `Graph::connect` does. An input socket can only be fed by
+    /// one output, so any previous link into `at_in_socket` is replaced.
+    template <typename From, typename To = From>
+      requires Convertible<From, To>
+    void connect(NodeId from_node, SocketId at_out_socket, NodeId to_node,
+                 SocketId at_in_socket) {
+      check_node(from_node);
+      check_node(to_node);
+
+      // Throw if the sockets do not exist or hold other types.
+      draft_.nodes[from_node]->checked_output_socket<From>(at_out_socket);
+      draft_.nodes[to_node]->checked_input_socket<To>(at_in_socket);
+
+      disconnect_input(to_node, at_in_socket);
+      own_links(from_node).push_back(Link{at_out_socket, to_node,
+                                          at_in_socket,
+                                          &convert_value<From, To>});
+      auto &feeding = own_feeders(to_node);
+      if (feeding.size() <= at_in_socket) {
+        feeding.resize(at_in_socket + 1, Topology::unconnected);
+      }
+      feeding[at_in_socket] = from_node;
+
+      unsorted_ |= draft_.position[from_node] > draft_.position[to_node];
+    };
+
+    void disconnect(NodeId from_node, SocketId at_out_socket, NodeId to_node,
+                    SocketId at_in_socket) {
+      check_node(from_node);
+      check_node(to_node);
+
+      if (feeder(to_node, at_in_socket) == from_node &&
+          std::ranges::any_of(*draft_.links[from_node], [&](const Link &link) {
+            return link.source_socket == at_out_socket &&
+                   link.destination_node == to_node &&
+                   link.destination_socket == at_in_socket;
+          })) {
+        unlink(from_node, to_node, at_in_socket);
+      }
+    };
+
+    void disconnect_input(NodeId to_node, SocketId at_in_socket) {
+      check_node(to_node);
+
+      if (auto from = feeder(to_node, at_in_socket);
+          from != Topology::unconnected) {
+        unlink(from, to_node, at_in_socket);
+      }
+    };
+
+    const Topology &draft() const { return draft_; };
+
+    /// Publishes the edited topology. Throws, leaving the published
+    /// topology untouched, if the edit introduced a directed cycle.
+    void commit() {
+      if (!lock_.owns_lock()) {
+        throw std::runtime_error("Edit has already been committed");
+      }
+
+      // Removing links keeps the order valid, and so do new links that
+      // follow it.
+      if (unsorted_) {
+        draft_.sort();
+      }
+      draft_.version++;
+
+      graph_.current_.store(std::make_shared<const Topology>(std::move(draft_)),
+                            std::memory_order_release);
+      lock_.unlock();
+    };
+  };
+
+  VersionedGraph() : current_(std::make_shared<const Topology>()) {};
+
+  /// Takes the nodes and links of `graph`. Nodes are shared with
+  /// `graph`, which should not be evaluated on its own afterwards.
+  explicit VersionedGraph(const Graph &graph)
+      : current_(std::make_shared<const Topology>(Topology::of(graph))) {};
+
+  /// Latest published topology. The returned version stays
+  /// alive, and unchanged, for as long as it is referenced.
+  std::shared_ptr<const Topology> snapshot() const {
+    return current_.load(std::memory_order_acquire);
+  };
+
+  /// Starts an edit on top of the latest published topology.
+  /// Blocks other editors, never evaluations, until committed
+  /// or destroyed. Destroying an uncommitted edit discards it.
+  Edit edit() { return Edit(*this); };
+
+  /// Topology version evaluated by `evaluate`, and how far it got.
+  struct Evaluation {
+    std::shared_ptr<const Topology> topology;
+    EvaluationStatus status;
+  };
+
+  /// Evaluates the latest published topology, stopping early once
+  /// `stop` is reached, see `evaluate(topology, stop)`.
+  Evaluation evaluate(const StopCondition &stop = {}) {
+    auto topology = snapshot();
+    auto status = evaluate(*topology, stop);
+    return {std::move(topology), std::move(status)};
+  };
+
+  /// Runs every node of `topology` in order, stopping early if `stop`
+  /// is reached. As in `Evaluator::evaluate`, the condition is checked
+  /// between nodes and nodes can check it through
+  /// `Node::stop_requested`.
+  static EvaluationStatus evaluate(const Topology &topology,
+                                   const StopCondition &stop = {}) {
+    EvaluationStatus status;
+    StopScope scope(stop);
+    status.completed.reserve(topology.order.size());
+
+    for (auto id : topology.order) {
+      if (stop.reached()) {
+        break;
+      }
+
+      const auto &source = topology.nodes[id];
+      if (!run_to_end(*source)) {
+        status.interrupted.push_back(id);
+        break;
+      }
+
+      for (const auto &link : topology.links_of(id)) {
+        auto output = source->get_untyped_output_socket(link.source_socket);
+        auto input = topology.nodes[link.destination_node]
+                         ->get_untyped_input_socket(link.destination_socket);
+        transfer_value(link, *output, *input);
+      }
+      status.completed.push_back(id);
+    }
+
+    if (status.completed.size() < topology.order.size()) {
+      status.outcome = stop.cancelled() ? EvaluationStatus::CANCELLED
+                                        : EvaluationStatus::DEADLINE_EXCEEDED;
+    }
+    return status;
+  };
+};
+
+} // namespace qgraph
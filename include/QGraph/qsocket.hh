@@ -1,117 +1,656 @@
 #pragma once
 
+#include <QGraph/qarena.hh>
+#include <QGraph/qconversion.hh>
 #include <QGraph/qlink.hh>
+#include <QGraph/qmemory.hh>
+#include <QGraph/qserializer.hh>
 #include <QGraph/qtypes.hh>
+#include <algorithm>
 #include <any>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <new>
 #include <optional>
-#include <set>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <utility>
 
 namespace qgraph {
 
+class Socket;
+
+/// Single allocation holding every socket of a compacted graph.
+/// See `Graph::compact`.
+class SocketBlock {
+private:
+  std::pmr::monotonic_buffer_resource memory_;
+  // Sockets whose destructor has to run when the block is released.
+  std::vector<Socket *> owned_;
+
+public:
+  explicit SocketBlock(std::size_t size) : memory_(size) {};
+  SocketBlock(const SocketBlock &) = delete;
+  SocketBlock &operator=(const SocketBlock &) = delete;
+  ~SocketBlock();
+
+  template <typename S, typename... Args> S *construct(Args &&...args) {
+    return new (memory_.allocate(sizeof(S), alignof(S)))
+        S(std::forward<Args>(args)...);
+  };
+
+  // Runs the destructor of `socket` when the block is released.
+  // Sockets whose destructor has no effect can skip this.
+  void adopt(Socket *socket) { owned_.push_back(socket); };
+
+  std::size_t bookkeeping_bytes() const {
+    return owned_.capacity() * sizeof(Socket *);
+  };
+};
+
+/// Default values found while compacting a graph. Equal defaults
+/// of hashable types are kept once and shared among sockets.
+class DefaultPool {
+private:
+  template <typename T> struct Pointee {
+    std::size_t operator()(const std::shared_ptr<const T> &value) const {
+      return std::hash<T>{}(*value);
+    };
+    bool operator()(const std::shared_ptr<const T> &lhs,
+                    const std::shared_ptr<const T> &rhs) const {
+      return *lhs == *rhs;
+    };
+  };
+
+  template <typename T>
+  using Pool =
+      std::unordered_set<std::shared_ptr<const T>, Pointee<T>, Pointee<T>>;
+
+  std::unordered_map<std::type_index, std::shared_ptr<void>> pools_;
+
+public:
+  template <typename T>
+  std::shared_ptr<const T> share(std::shared_ptr<const T> value) {
+    if constexpr (std::equality_comparable<T> && requires(const T &v) {
+                    { std::hash<T>{}(v) } -> std::convertible_to<std::size_t>;
+                  }) {
+      if (value == nullptr) {
+        return value;
+      }
+
+      auto &pool = pools_[typeid(T)];
+      if (pool == nullptr) {
+        pool = std::make_shared<Pool<T>>();
+      }
+      return *static_cast<Pool<T> *>(pool.get())->insert(value).first;
+    } else {
+      return value;
+    }
+  };
+};
+
+// Name of a socket. Kept out of line, away from the values, and
+// dropped from compacted sockets, whose node still knows it.
+class Label {
+private:
+  std::unique_ptr<const std::string> text_;
+
+public:
+  Label() = default;
+  Label(const std::string &text)
+      : text_(std::make_unique<const std::string>(text)) {};
+  Label(const Label &other)
+      : text_(other.text_ ? std::make_unique<const std::string>(*other.text_)
+                          : nullptr) {};
+  Label(Label &&other) = default;
+  Label &operator=(Label &&other) = default;
+
+  std::string_view view() const {
+    return text_ ? std::string_view(*text_) : std::string_view();
+  };
+
+  std::size_t memory() const {
+    return sizeof(*this) + (text_ ? heap_block(sizeof(std::string)) +
+                                        owned_bytes(*text_)
+                                  : 0);
+  };
+};
+
+// Default value of a socket. Small trivially copyable values are
+// stored inline; others out of line, so that `Graph::compact` can
+// make sockets with equal defaults share them.
+template <typename T> class DefaultValue {
+private:
+  static constexpr bool stored_inline =
+      std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(void *);
+
+  std::conditional_t<stored_inline, T, std::shared_ptr<const T>> value_{};
+
+public:
+  const T &get() const {
+    if constexpr (stored_inline) {
+      return value_;
+    } else {
+      static const T none{};
+      return value_ ? *value_ : none;
+    }
+  };
+
+  void set(T to) {
+    if constexpr (stored_inline) {
+      value_ = to;
+    } else {
+      value_ = std::make_shared<const T>(std::move(to));
+    }
+  };
+
+  void share(DefaultPool &pool) {
+    if constexpr (!stored_inline) {
+      value_ = pool.share(std::move(value_));
+    }
+  };
+
+  // Shared defaults are split evenly among the sockets sharing them.
+  std::size_t memory() const {
+    if constexpr (stored_inline) {
+      return sizeof(*this);
+    } else {
+      return sizeof(*this) +
+             (value_ ? (heap_block(sizeof(T) + 2 * sizeof(void *)) +
+                        owned_bytes(*value_)) /
+                           value_.use_count()
+                     : 0);
+    }
+  };
+};
+
+// Stores `to` into `current` and returns true, unless both are
+// trivially copyable values with the same bytes.
+template <typename T, typename U> bool store_value(T &current, U &&to) {
+  if constexpr (std::is_trivially_copyable_v<T>) {
+    const T &value = to;
+    if (std::memcmp(&current, &value, sizeof(T)) == 0) {
+      return false;
+    }
+  }
+  current = std::forward<U>(to);
+  return true;
+};
+
 class Socket {
 private:
+  // Grows every time the current value may have changed, drawn from
+  // the change counter of the node holding the socket, if any.
+  std::uint64_t version_ = 0;
+
+  // Change counter of the node holding this socket, see
+  // `Node::values_version`. Copies belong to no node until adopted.
+  std::uint64_t *owner_changes_ = nullptr;
+
+  // Incremented every time links to or from this socket change.
+  std::uint32_t links_version_ = 0;
+
+  static constexpr SocketId unassigned = std::numeric_limits<SocketId>::max();
+
   // Index in parent node input sockets.
-  // May not be initialized when the socket is created.
-  std::optional<SocketId> id_;
+  // May not be assigned when the socket is created.
+  SocketId id_ = unassigned;
+
+  // Whether this socket lives in a `SocketBlock`. Describes the
+  // allocation, not the socket, so it is not copied.
+  bool in_block_ = false;
+
+protected:
+  void mark_changed() {
+    version_ = owner_changes_ != nullptr ? ++*owner_changes_ : version_ + 1;
+  };
+  void mark_links_changed() { links_version_++; };
+
+  // Called on the copy placed in `block` by `compact_into`.
+  void placed_in_block() { in_block_ = true; };
 
 public:
+  Socket() = default;
+  Socket(const Socket &other)
+      : version_(other.version_), links_version_(other.links_version_),
+        id_(other.id_) {};
+
   void set_id(SocketId to) {
-    if (!id_.has_value()) {
+    if (id_ == unassigned) {
       id_ = to;
     }
   };
 
   SocketId id() {
-    return id_.has_value()
-               ? id_.value()
+    return id_ != unassigned
+               ? id_
                : throw std::runtime_error("The current socket has no ID");
   }
 
+  bool in_block() const { return in_block_; };
+
+  // Called by the node holding this socket with its change counter.
+  // Counts as a change, so that checkpoints pick up adopted sockets.
+  void set_owner(std::uint64_t *changes) {
+    owner_changes_ = changes;
+    mark_changed();
+  };
+
+  // Called by a node letting go of this socket, if it still owns it.
+  void release_owner(const std::uint64_t *changes) {
+    if (owner_changes_ == changes) {
+      owner_changes_ = nullptr;
+    }
+  };
+
+  // See `Node::topology_version`.
+  std::uint32_t links_version() const { return links_version_; };
+
   virtual ~Socket() = default;
-  virtual std::set<Link> get_neighbors() const { return {}; };
-  virtual void set_current_value(const std::any to) {};
+  virtual const std::vector<Link> &get_neighbors() const {
+    static const std::vector<Link> none;
+    return none;
+  };
+
+  // Node and output socket feeding this input socket, if any.
+  // Always empty for output sockets.
+  virtual std::optional<std::pair<NodeId, SocketId>> source() const {
+    return std::nullopt;
+  };
+  virtual void set_source(std::optional<std::pair<NodeId, SocketId>>) {};
+
+  // Calls `rewrite` on every link leaving this output socket, keeping
+  // those it returns true for. `rewrite` may change the destination
+  // node as long as it preserves the order of links, see `Graph::Edit`.
+  virtual void rewrite_links(const std::function<bool(Link &)> &) {};
+  virtual void set_current_value(const std::any) {};
   virtual std::any get_untyped_current_value() const { return std::any(0); };
+
+  // Copies the current value of `source` into this socket without
+  // going through `std::any`. Both sockets must hold the same type.
+  virtual void assign_current_value(const Socket &) {};
+
+  // Returns a copy of this socket allocated inside `arena`.
+  virtual std::shared_ptr<Socket> relocate(const Arena &) const {
+    return nullptr;
+  };
+
+  // Places a copy of this socket, without label, inside `block`,
+  // sharing its default value through `defaults`.
+  virtual Socket *compact_into(SocketBlock &, DefaultPool &) const {
+    return nullptr;
+  };
+
+  // Size of the socket object, which `memory_stats` adds to `stats`
+  // along with whatever the socket owns.
+  virtual std::size_t object_size() const { return sizeof(*this); };
+  virtual void count_memory(MemoryStats &stats) const {
+    stats.sockets += sizeof(*this);
+  };
+
+  // Size in bytes of the current value if it can be copied
+  // bytewise (trivially copyable types), zero otherwise.
+  virtual std::size_t trivial_value_size() const { return 0; };
+
+  // Storage of the current value. Only meaningful when
+  // `trivial_value_size()` is not zero.
+  virtual const void *current_value_data() const { return nullptr; };
+  virtual void *mutable_current_value_data() { return nullptr; };
+
+  // Grows whenever the current value is written, or handed out for
+  // writing. Writing a trivially copyable value equal to the current
+  // one leaves it as is. Versions of the sockets of a node are drawn
+  // from `Node::values_version`. Used by incremental checkpoints.
+  std::uint64_t version() const { return version_; };
+
+  // Appends the bytes of the current value to `out`. Returns false
+  // if the value is neither trivially copyable nor has a `Serializer`.
+  virtual bool save_current_value(std::vector<std::byte> &) const {
+    return false;
+  };
+
+  // Replaces the current value with one saved by `save_current_value`.
+  virtual bool load_current_value(const std::byte *, std::size_t) {
+    return false;
+  };
 };
 
+template <typename T> class OutSocket;
+
 template <typename T> class InSocket : public Socket {
 private:
-  T default_value_;
-  T current_value_;
-  std::optional<Link> connected_to_;
-  std::string label_;
+  static constexpr NodeId unconnected = std::numeric_limits<NodeId>::max();
+
+  // Output socket feeding this one, if any.
+  NodeId source_node_ = unconnected;
+  SocketId source_socket_ = 0;
+
+  T current_value_{};
+  DefaultValue<T> default_value_;
+  Label label_;
 
 public:
   InSocket(const std::string &label) : label_(label) {};
 
-  std::optional<Link> connected_to() { return connected_to_; }
+  std::optional<Link> connected_to() {
+    if (source_node_ == unconnected) {
+      return std::nullopt;
+    }
+    return Link{this->id(), source_node_, source_socket_};
+  }
+
+  std::string_view label() const { return label_.view(); }
 
-  std::string_view label() const { return label_; }
+  const T &current_value() const { return current_value_; };
+  const T &default_value() const { return default_value_.get(); };
 
-  T current_value() const { return current_value_; };
-  T default_value() const { return default_value_; };
+  // In-place access to the current value. Prefer this over
+  // a get/set pair when `T` is expensive to copy.
+  T &mutable_current_value() {
+    mark_changed();
+    return current_value_;
+  };
 
   void set_current_value(const std::any to) override {
-    current_value_ = std::any_cast<T>(to);
+    if (store_value(current_value_, std::any_cast<T>(to))) {
+      mark_changed();
+    }
   };
 
-  void set_current_value(const T to) { current_value_ = to; };
-  void set_default_value(const T to) { default_value_ = to; };
+  void set_current_value(const T &to) {
+    if (store_value(current_value_, to)) {
+      mark_changed();
+    }
+  };
+  void set_current_value(T &&to) {
+    if (store_value(current_value_, std::move(to))) {
+      mark_changed();
+    }
+  };
+  void set_default_value(const T &to) { default_value_.set(to); };
+  void set_default_value(T &&to) { default_value_.set(std::move(to)); };
   void set_default_value(const std::any to) {
-    default_value_ = std::any_cast<T>(to);
+    default_value_.set(std::any_cast<T>(to));
+  };
+
+  void assign_current_value(const Socket &source) override;
+
+  std::shared_ptr<Socket> relocate(const Arena &arena) const override {
+    return std::allocate_shared<InSocket<T>>(ArenaAllocator<InSocket<T>>(arena),
+                                             *this);
+  };
+
+  Socket *compact_into(SocketBlock &block,
+                       DefaultPool &defaults) const override {
+    auto socket = block.construct<InSocket<T>>(*this);
+    socket->label_ = Label();
+    socket->default_value_.share(defaults);
+    socket->placed_in_block();
+
+    // Without a label, there is nothing to release unless the values
+    // own memory.
+    if constexpr (!std::is_trivially_destructible_v<T> ||
+                  !std::is_trivially_destructible_v<DefaultValue<T>>) {
+      block.adopt(socket);
+    }
+    return socket;
+  };
+
+  std::size_t object_size() const override { return sizeof(*this); };
+
+  void count_memory(MemoryStats &stats) const override {
+    stats.sockets += sizeof(*this) - sizeof(current_value_) -
+                     sizeof(default_value_) - sizeof(label_);
+    stats.labels += label_.memory();
+    stats.values += sizeof(current_value_) + owned_bytes(current_value_) +
+                    default_value_.memory();
+  };
+
+  std::size_t trivial_value_size() const override {
+    return std::is_trivially_copyable_v<T> ? sizeof(T) : 0;
+  };
+  const void *current_value_data() const override { return &current_value_; };
+  void *mutable_current_value_data() override {
+    mark_changed();
+    return &current_value_;
+  };
+
+  bool save_current_value(std::vector<std::byte> &out) const override {
+    return save_value(current_value_, out);
+  };
+
+  bool load_current_value(const std::byte *data, std::size_t size) override {
+    mark_changed();
+    return load_value(current_value_, data, size);
   };
 
   void connect(const qgraph::NodeId to_node, const qgraph::SocketId at_socket) {
-    connected_to_ = Link{this->id(), to_node, at_socket};
+    source_node_ = to_node;
+    source_socket_ = at_socket;
+    mark_links_changed();
+  };
+
+  void disconnect() {
+    source_node_ = unconnected;
+    mark_links_changed();
   };
 
-  void disconnect() { connected_to_.reset(); };
+  std::optional<std::pair<NodeId, SocketId>> source() const override {
+    if (source_node_ == unconnected) {
+      return std::nullopt;
+    }
+    return std::pair{source_node_, source_socket_};
+  };
+
+  void
+  set_source(std::optional<std::pair<NodeId, SocketId>> source) override {
+    if (source) {
+      connect(source->first, source->second);
+    } else {
+      disconnect();
+    }
+  };
 };
 
 template <typename T> class OutSocket : public Socket {
 private:
-  T default_value_;
-  T current_value_;
-  // Set containing all input sockets this is connected to.
-  std::set<Link> connected_to_;
-  // Label of the node.
-  std::string label_;
+  T current_value_{};
+  DefaultValue<T> default_value_;
+  // All input sockets this is connected to, sorted.
+  std::vector<Link> connected_to_;
+  Label label_;
 
 public:
   OutSocket(const std::string &label) : label_(label) {};
 
-  T current_value() const { return current_value_; };
-  T default_value() const { return default_value_; }
+  const T &current_value() const { return current_value_; };
+  const T &default_value() const { return default_value_.get(); }
 
-  std::string_view label() const { return label_; }
+  // In-place access to the current value. Nodes producing large
+  // payloads can fill the output buffer without an extra copy.
+  T &mutable_current_value() {
+    mark_changed();
+    return current_value_;
+  };
 
-  std::set<Link> connected_to() const { return connected_to_; }
-  void set_current_value(const T to) { current_value_ = to; };
-  void set_default_value(const T to) { default_value_ = to; };
+  std::string_view label() const { return label_.view(); }
 
-  void connect(const qgraph::NodeId to_node, const qgraph::SocketId at_socket) {
-    connected_to_.emplace(id(), to_node, at_socket);
+  const std::vector<Link> &connected_to() const { return connected_to_; }
+  void set_current_value(const T &to) {
+    if (store_value(current_value_, to)) {
+      mark_changed();
+    }
+  };
+  void set_current_value(T &&to) {
+    if (store_value(current_value_, std::move(to))) {
+      mark_changed();
+    }
+  };
+  void set_default_value(const T &to) { default_value_.set(to); };
+  void set_default_value(T &&to) { default_value_.set(std::move(to)); };
+
+  void connect(const qgraph::NodeId to_node, const qgraph::SocketId at_socket,
+               Converter convert = nullptr) {
+    Link link{id(), to_node, at_socket, convert};
+    auto at =
+        std::lower_bound(connected_to_.begin(), connected_to_.end(), link);
+    if (at == connected_to_.end() || link < *at) {
+      connected_to_.insert(at, link);
+    }
+    mark_links_changed();
   };
 
   void disconnect(const uint16_t to_node, const uint16_t at_socket) {
-    connected_to_.erase({id(), to_node, at_socket});
+    Link link{id(), to_node, at_socket};
+    auto at =
+        std::lower_bound(connected_to_.begin(), connected_to_.end(), link);
+    if (at != connected_to_.end() && !(link < *at)) {
+      connected_to_.erase(at);
+    }
+    mark_links_changed();
+  };
+
+  const std::vector<Link> &get_neighbors() const override {
+    return this->connected_to_;
+  }
+
+  // Bulk linking, see `Graph::Edit`. `reserve_links` makes room for
+  // `count` more links, `append_link` adds one without keeping links
+  // sorted and `merge_links` merges the last `appended` links, appended
+  // in order, into the others. Only merging may allocate once room has
+  // been reserved.
+  void reserve_links(std::size_t count) {
+    connected_to_.reserve(connected_to_.size() + count);
+  };
+
+  void append_link(const Link &link) { connected_to_.push_back(link); };
+
+  void merge_links(std::size_t appended) {
+    auto middle = connected_to_.end() - appended;
+    // Usually the new links come after the existing ones. Otherwise,
+    // merging falls back to working in place if no buffer can be had.
+    if (middle != connected_to_.begin() && *middle < *(middle - 1)) {
+      std::inplace_merge(connected_to_.begin(), middle, connected_to_.end());
+    }
+    mark_links_changed();
   };
 
-  std::set<Link> get_neighbors() const override { return this->connected_to_; }
+  void rewrite_links(const std::function<bool(Link &)> &rewrite) override {
+    auto kept = [&](Link &link) { return !rewrite(link); };
+    connected_to_.erase(
+        std::remove_if(connected_to_.begin(), connected_to_.end(), kept),
+        connected_to_.end());
+    mark_links_changed();
+  };
 
   std::any get_untyped_current_value() const override {
     return std::any(current_value_);
   };
 
   std::any get_untyped_default_value() const {
-    return std::any(default_value_);
+    return std::any(default_value_.get());
+  };
+
+  std::shared_ptr<Socket> relocate(const Arena &arena) const override {
+    return std::allocate_shared<OutSocket<T>>(
+        ArenaAllocator<OutSocket<T>>(arena), *this);
+  };
+
+  Socket *compact_into(SocketBlock &block,
+                       DefaultPool &defaults) const override {
+    auto socket = block.construct<OutSocket<T>>(*this);
+    socket->label_ = Label();
+    socket->default_value_.share(defaults);
+    socket->placed_in_block();
+    block.adopt(socket);
+    return socket;
+  };
+
+  std::size_t object_size() const override { return sizeof(*this); };
+
+  void count_memory(MemoryStats &stats) const override {
+    stats.sockets += sizeof(*this) - sizeof(current_value_) -
+                     sizeof(default_value_) - sizeof(connected_to_) -
+                     sizeof(label_);
+    stats.labels += label_.memory();
+    stats.links += sizeof(connected_to_) + owned_bytes(connected_to_);
+    stats.values += sizeof(current_value_) + owned_bytes(current_value_) +
+                    default_value_.memory();
+  };
+
+  std::size_t trivial_value_size() const override {
+    return std::is_trivially_copyable_v<T> ? sizeof(T) : 0;
+  };
+  const void *current_value_data() const override { return &current_value_; };
+  void *mutable_current_value_data() override {
+    mark_changed();
+    return &current_value_;
+  };
+
+  bool save_current_value(std::vector<std::byte> &out) const override {
+    return save_value(current_value_, out);
+  };
+
+  bool load_current_value(const std::byte *data, std::size_t size) override {
+    mark_changed();
+    return load_value(current_value_, data, size);
   };
 };
 
+inline SocketBlock::~SocketBlock() {
+  for (auto socket : owned_) {
+    socket->~Socket();
+  }
+};
+
+template <typename T>
+void InSocket<T>::assign_current_value(const Socket &source) {
+  // Links without a converter are only made between sockets of the
+  // same type; `Graph::connect` and `Graph::Edit` check it.
+  assert(dynamic_cast<const OutSocket<T> *>(&source) != nullptr);
+  if (store_value(current_value_,
+                  static_cast<const OutSocket<T> &>(source).current_value())) {
+    mark_changed();
+  }
+};
+
+// Converter for links from an `OutSocket<From>` into an `InSocket<To>`.
+template <typename From, typename To>
+  requires Convertible<From, To>
+void convert_value(const Socket &from, Socket &to) {
+  const auto &value =
+      static_cast<const OutSocket<From> &>(from).current_value();
+  auto &input = static_cast<InSocket<To> &>(to);
+
+  if constexpr (std::is_same_v<From, To>) {
+    input.set_current_value(value);
+  } else {
+    input.set_current_value(Conversion<From, To>::convert(value));
+  }
+};
+
+// Copies the current value of `from` into `to` along `link`.
+inline void transfer_value(const Link &link, const Socket &from, Socket &to) {
+  if (link.convert != nullptr) {
+    link.convert(from, to);
+  } else {
+    to.assign_current_value(from);
+  }
+};
+
 namespace builder {
 
 template <typename T> class InSocketBuilder {
@@ -122,10 +661,10 @@ public:
   InSocketBuilder(std::shared_ptr<qgraph::InSocket<T>> socket)
       : socket_(socket) {};
 
-  InSocketBuilder &with_default_value(const T default_value) {
+  InSocketBuilder &with_default_value(T default_value) {
     if (auto ptr = socket_.lock()) {
       ptr->set_default_value(default_value);
-      ptr->set_current_value(default_value);
+      ptr->set_current_value(std::move(default_value));
       return *this;
     } else {
       throw std::runtime_error("Input socket reference is expired");
@@ -141,10 +680,10 @@ public:
   OutSocketBuilder(std::shared_ptr<qgraph::OutSocket<T>> socket)
       : socket_(socket) {};
 
-  OutSocketBuilder &with_default_value(const T default_value) {
+  OutSocketBuilder &with_default_value(T default_value) {
     if (auto ptr = socket_.lock()) {
       ptr->set_default_value(default_value);
-      ptr->set_current_value(default_value);
+      ptr->set_current_value(std::move(default_value));
       return *this;
     } else {
       throw std::runtime_error("Ouput socket reference is expired");
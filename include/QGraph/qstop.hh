@@ -0,0 +1,102 @@
+#pragma once
+
+#include "QGraph/qtypes.hh"
+#include <atomic>
+#include <chrono>
+#include <stop_token>
+#include <vector>
+
+namespace qgraph {
+
+/// Tells an evaluation to stop before every node has run: once
+/// `deadline` passes, or once a stop is requested through `token`.
+/// Both are optional:
+///
+///     eval.evaluate({.deadline = std::chrono::steady_clock::now() + 5ms});
+///     eval.evaluate({.token = source.get_token()});
+struct StopCondition {
+  using Clock = std::chrono::steady_clock;
+
+  Clock::time_point deadline = Clock::time_point::max();
+  // Initialized so that designated initializers may leave it out.
+  std::stop_token token{};
+
+  bool cancelled() const { return token.stop_requested(); };
+
+  bool expired() const {
+    return deadline != Clock::time_point::max() && Clock::now() >= deadline;
+  };
+
+  bool reached() const { return cancelled() || expired(); };
+};
+
+/// Result of an evaluation.
+struct EvaluationStatus {
+  enum Outcome {
+    // Every node ran.
+    COMPLETED,
+    // The deadline passed before every node ran.
+    DEADLINE_EXCEEDED,
+    // A stop was requested before every node ran.
+    CANCELLED,
+    // The graph contains a directed cycle, no node ran.
+    INVALID
+  };
+
+  Outcome outcome = COMPLETED;
+  // Nodes that ran, in the order they finished. Their outputs, and
+  // the inputs they feed, hold the values of this evaluation.
+  std::vector<NodeId> completed;
+  // Nodes that were told to stop through `Node::stop_requested` while
+  // they ran. They may have returned early, leaving partial values in
+  // their outputs, which were not passed on to the inputs they feed.
+  std::vector<NodeId> interrupted;
+
+  bool finished() const { return outcome == COMPLETED; };
+};
+
+// Stop of the evaluation running on this thread, see
+// `Node::stop_requested`.
+struct ActiveStop {
+  const StopCondition *condition = nullptr;
+  // Set from elsewhere to stop, see `PartitionedEvaluator`.
+  const std::atomic<bool> *remote = nullptr;
+  // Whether a node has been told to stop since this was last cleared.
+  bool seen = false;
+
+  bool reached() const {
+    return (condition != nullptr && condition->reached()) ||
+           (remote != nullptr && remote->load(std::memory_order_acquire));
+  };
+};
+
+inline thread_local ActiveStop active_stop;
+
+// Makes `stop`, and `remote` if given, the stop of the evaluation
+// running on this thread while in scope.
+class StopScope {
+private:
+  ActiveStop previous_;
+
+public:
+  explicit StopScope(const StopCondition &stop,
+                     const std::atomic<bool> *remote = nullptr)
+      : previous_(active_stop) {
+    active_stop = {&stop, remote, false};
+  };
+  StopScope(const StopScope &) = delete;
+  StopScope &operator=(const StopScope &) = delete;
+  ~StopScope() { active_stop = previous_; };
+};
+
+// Runs `node` and returns whether it ran to its end, that is, whether
+// it was never told to stop through `Node::stop_requested`. Nodes
+// that finish while the stop is reached, without checking it, count
+// as having run to their end.
+template <typename N> bool run_to_end(N &node) {
+  active_stop.seen = false;
+  node.execute();
+  return !active_stop.seen;
+};
+
+} // namespace qgraph
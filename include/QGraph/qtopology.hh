@@ -0,0 +1,113 @@
+#pragma once
+
+#include "QGraph/qgraph.hh"
+#include "QGraph/qlink.hh"
+#include "QGraph/qnode.hh"
+#include "QGraph/qtypes.hh"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace qgraph {
+
+/// Immutable version of a graph topology: which nodes exist, how they
+/// are linked and in which order they are evaluated.
+///
+/// Nodes, and the links of nodes whose links did not change, are
+/// shared between versions. A topology never changes once it has been
+/// published, so it can be read without any synchronization.
+struct Topology {
+  using Links = std::vector<Link>;
+  // Node feeding every input socket of a node, or `unconnected`.
+  using Feeders = std::vector<NodeId>;
+
+  static constexpr NodeId unconnected = std::numeric_limits<NodeId>::max();
+
+  std::vector<std::shared_ptr<Node>> nodes;
+  // Outgoing links of every node, indexed by node id.
+  std::vector<std::shared_ptr<const Links>> links;
+  // Incoming links of every node, indexed by node id. Input sockets
+  // past the end are not connected.
+  std::vector<std::shared_ptr<const Feeders>> feeders;
+  // Node ids in evaluation order, and the index of every node in it.
+  std::vector<NodeId> order;
+  std::vector<size_t> position;
+  std::uint64_t version = 0;
+
+  const std::shared_ptr<Node> &node(NodeId id) const { return nodes.at(id); };
+
+  const Links &links_of(NodeId id) const { return *links[id]; };
+
+  size_t num_of_nodes() const { return nodes.size(); };
+
+  /// Takes the nodes and links of `graph` and sorts them.
+  /// Nodes are shared with `graph`.
+  static Topology of(const Graph &graph) {
+    Topology topology;
+    std::vector<Feeders> feeders(graph.num_of_nodes());
+
+    for (NodeId id = 0; id < graph.num_of_nodes(); ++id) {
+      topology.nodes.push_back(graph.node(id));
+      Links outgoing;
+      for (const auto &link : graph.node(id)->get_neighbors()) {
+        outgoing.push_back(link);
+        auto &feeding = feeders[link.destination_node];
+        if (feeding.size() <= link.destination_socket) {
+          feeding.resize(link.destination_socket + 1, unconnected);
+        }
+        feeding[link.destination_socket] = id;
+      }
+      topology.links.push_back(
+          std::make_shared<const Links>(std::move(outgoing)));
+    }
+    for (auto &feeding : feeders) {
+      topology.feeders.push_back(
+          std::make_shared<const Feeders>(std::move(feeding)));
+    }
+
+    topology.sort();
+    return topology;
+  };
+
+  // Computes `order` and `position` by topological sorting.
+  // Throws if the links contain a directed cycle.
+  void sort() {
+    std::vector<size_t> pending(nodes.size(), 0);
+    for (const auto &outgoing : links) {
+      for (const auto &link : *outgoing) {
+        pending[link.destination_node]++;
+      }
+    }
+
+    order.clear();
+    order.reserve(nodes.size());
+    for (NodeId id = 0; id < nodes.size(); ++id) {
+      if (pending[id] == 0) {
+        order.push_back(id);
+      }
+    }
+
+    for (size_t i = 0; i < order.size(); ++i) {
+      for (const auto &link : *links[order[i]]) {
+        if (--pending[link.destination_node] == 0) {
+          order.push_back(link.destination_node);
+        }
+      }
+    }
+
+    if (order.size() != nodes.size()) {
+      throw std::invalid_argument("Topology contains a directed cycle");
+    }
+
+    position.resize(nodes.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      position[order[i]] = i;
+    }
+  };
+};
+
+} // namespace qgraph
@@ -1,11 +1,29 @@
 #include "QGraph/qevaluator.hh"
 #include "QGraph/qgraph.hh"
 #include <QGraph/qnode.hh>
+#include <QGraph/qpartition.hh>
+#include <QGraph/qshared.hh>
+#include <QGraph/qsnapshot.hh>
 #include <QGraph/qsocket.hh>
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
 #include <catch2/matchers/catch_matchers.hpp>
 #include <catch2/matchers/catch_matchers_vector.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stop_token>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
+
+template <> struct qgraph::Conversion<int, std::string> {
+  static std::string convert(int value) { return std::to_string(value); };
+};
 
 TEST_CASE("Socket builder", "[socket]") {
   qgraph::Node n;
@@ -33,6 +51,64 @@ TEST_CASE("Change current value", "[socket]") {
   REQUIRE(n.get_input_socket<float>("A").value()->default_value() == 10.0);
 }
 
+TEST_CASE("Reference access and move-in setters", "[socket]") {
+  qgraph::Node n;
+  n.add_output_socket<std::vector<int>>("Buffer");
+
+  auto out = n.output_socket<std::vector<int>>(0);
+
+  std::vector<int> payload(1024, 7);
+  const int *storage = payload.data();
+  out->set_current_value(std::move(payload));
+
+  // The socket took ownership of the buffer instead of copying it.
+  REQUIRE(out->current_value().data() == storage);
+
+  out->mutable_current_value()[0] = 1;
+
+  REQUIRE(&out->current_value() == &out->current_value());
+  REQUIRE(out->current_value()[0] == 1);
+}
+
+TEST_CASE("Shared payloads", "[socket]") {
+  using Buffer = qgraph::Shared<std::vector<int>>;
+
+  qgraph::Graph g;
+  g.add_node<qgraph::Node>();
+  g.add_node<qgraph::Node>();
+  g.add_node<qgraph::Node>();
+
+  g.node(0)->add_output_socket<Buffer>("Out").with_default_value(
+      Buffer(std::vector<int>(16, 3)));
+  g.node(1)->add_input_socket<Buffer>("In");
+  g.node(2)->add_input_socket<Buffer>("In");
+
+  g.connect<Buffer>(0, 0, 1, 0);
+  g.connect<Buffer>(0, 0, 2, 0);
+
+  qgraph::Evaluator eval(g);
+  eval.evaluate();
+
+  const auto &source = g.current_output_value<Buffer>(0, 0);
+  auto &a = g.node(1)->input_socket<Buffer>(0)->mutable_current_value();
+  const auto &b = g.current_input_value<Buffer>(2, 0);
+
+  SECTION("Fan-out shares one allocation") {
+    REQUIRE(a.shares_with(source));
+    REQUIRE(b.shares_with(source));
+  }
+
+  SECTION("Mutation copies on write") {
+    a.mutate()[0] = 42;
+
+    REQUIRE_FALSE(a.shares_with(source));
+    REQUIRE(b.shares_with(source));
+    REQUIRE(a->at(0) == 42);
+    REQUIRE(source->at(0) == 3);
+    REQUIRE(b->at(0) == 3);
+  }
+}
+
 TEST_CASE("Nodes", "[node]") {
   qgraph::MathNode math;
 
@@ -112,6 +188,56 @@ TEST_CASE("Tree evaluation", "[graph, evaluation]") {
 
   REQUIRE(g.current_output_value<int>(2, qgraph::MathNode::Socket::RESULT) ==
           4);
+
+  SECTION("Repeated evaluation") {
+    eval.evaluate();
+
+    REQUIRE(eval.get_execution_order().size() == 3);
+    REQUIRE(g.current_output_value<int>(2, qgraph::MathNode::Socket::RESULT) ==
+            4);
+  }
+}
+
+TEST_CASE("Mixed-type links", "[graph, evaluation]") {
+  qgraph::Graph g;
+  g.add_node<qgraph::ConstantNode>();
+  g.add_node<qgraph::Node>();
+  g.node(1)->add_input_socket<float>("Float");
+  g.node(1)->add_input_socket<std::string>("Text");
+
+  g.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 7);
+
+  SECTION("Arithmetic and registered conversions") {
+    g.connect<int, float>(0, qgraph::ConstantNode::Socket::Value, 1, 0);
+    g.connect<int, std::string>(0, qgraph::ConstantNode::Socket::Value, 1, 1);
+
+    qgraph::Evaluator eval(g);
+    eval.evaluate();
+
+    REQUIRE(g.current_input_value<float>(1, 0) == 7.0f);
+    REQUIRE(g.current_input_value<std::string>(1, 1) == "7");
+  }
+
+  SECTION("Sockets of other types are rejected") {
+    REQUIRE_THROWS_AS(g.connect<int>(0, 0, 1, 0), std::invalid_argument);
+    REQUIRE_THROWS_AS((g.connect<float, float>(0, 0, 1, 0)),
+                      std::invalid_argument);
+    REQUIRE(g.node(0)->output_socket<int>(0)->connected_to().empty());
+  }
+
+  SECTION("Versioned graphs convert too") {
+    qgraph::VersionedGraph versioned(g);
+    auto edit = versioned.edit();
+    edit.connect<int, float>(0, qgraph::ConstantNode::Socket::Value, 1, 0);
+    edit.commit();
+
+    versioned.evaluate();
+
+    REQUIRE(g.current_input_value<float>(1, 0) == 7.0f);
+  }
+
+  STATIC_REQUIRE(qgraph::Convertible<double, int>);
+  STATIC_REQUIRE_FALSE(qgraph::Convertible<std::string, int>);
 }
 
 TEST_CASE("Evaluation order", "[graph, evaluation]") {
@@ -176,3 +302,1050 @@ TEST_CASE("Invalid graph", "[graph, validation]") {
 
   REQUIRE_FALSE(eval.is_valid());
 }
+
+TEST_CASE("Parallel evaluation", "[graph, evaluation]") {
+  // ((10 + 20) + 30) + 40 with the constants feeding every level.
+  qgraph::Graph g;
+
+  g.add_node<qgraph::ConstantNode>(); // 0
+  g.add_node<qgraph::ConstantNode>(); // 1
+  g.add_node<qgraph::ConstantNode>(); // 2
+  g.add_node<qgraph::ConstantNode>(); // 3
+  g.add_node<qgraph::MathNode>();     // 4
+  g.add_node<qgraph::MathNode>();     // 5
+  g.add_node<qgraph::MathNode>();     // 6
+
+  g.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 10);
+  g.set_current_output_value<int>(1, qgraph::ConstantNode::Socket::Value, 30);
+  g.set_current_output_value<int>(2, qgraph::ConstantNode::Socket::Value, 40);
+  g.set_current_output_value<int>(3, qgraph::ConstantNode::Socket::Value, 20);
+
+  g.connect<int>(0, qgraph::ConstantNode::Socket::Value, 5,
+                 qgraph::MathNode::Socket::LHS);
+  g.connect<int>(3, qgraph::ConstantNode::Socket::Value, 5,
+                 qgraph::MathNode::Socket::RHS);
+  g.connect<int>(5, qgraph::MathNode::Socket::RESULT, 6,
+                 qgraph::MathNode::Socket::LHS);
+  g.connect<int>(1, qgraph::ConstantNode::Socket::Value, 6,
+                 qgraph::MathNode::Socket::RHS);
+  g.connect<int>(6, qgraph::MathNode::Socket::RESULT, 4,
+                 qgraph::MathNode::Socket::LHS);
+  g.connect<int>(2, qgraph::ConstantNode::Socket::Value, 4,
+                 qgraph::MathNode::Socket::RHS);
+
+  qgraph::Evaluator eval(g);
+
+  auto schedule = GENERATE(qgraph::Evaluator::FIFO,
+                           qgraph::Evaluator::CRITICAL_PATH);
+
+  eval.evaluate_parallel(4, schedule);
+
+  REQUIRE(g.current_output_value<int>(4, qgraph::MathNode::Socket::RESULT) ==
+          100);
+
+  SECTION("Node costs are measured") {
+    for (qgraph::NodeId node = 0; node < g.num_of_nodes(); ++node) {
+      REQUIRE(eval.node_cost(node) >= 0);
+    }
+  }
+
+  SECTION("Node costs are dropped once nodes are renumbered") {
+    auto edit = g.begin_edit();
+    edit.remove_node(3);
+    edit.commit();
+
+    // Sorts the graph again without running any node.
+    std::stop_source source;
+    source.request_stop();
+    eval.evaluate({.token = source.get_token()});
+
+    for (qgraph::NodeId node = 0; node < g.num_of_nodes(); ++node) {
+      REQUIRE(eval.node_cost(node) < 0);
+    }
+  }
+
+  SECTION("Critical path decreases along the chain") {
+    REQUIRE(eval.critical_path(5) > eval.critical_path(6));
+    REQUIRE(eval.critical_path(6) > eval.critical_path(4));
+    REQUIRE(eval.critical_path(0) > eval.critical_path(2));
+  }
+}
+
+TEST_CASE("Parallel evaluation errors", "[graph, evaluation]") {
+  class FailingNode : public qgraph::Node {
+  public:
+    void execute() override { throw std::runtime_error("Node failed"); };
+  };
+
+  qgraph::Graph g;
+  g.add_node<FailingNode>();
+  g.add_node<qgraph::MathNode>();
+
+  qgraph::Evaluator eval(g);
+
+  REQUIRE_THROWS_AS(eval.evaluate_parallel(2), std::runtime_error);
+}
+
+TEST_CASE("Stopping evaluation", "[graph, evaluation]") {
+  // Runs until the evaluation is asked to stop, or for two seconds.
+  class WaitingNode : public qgraph::Node {
+  public:
+    WaitingNode() {
+      add_input_socket<int>("In");
+      add_output_socket<int>("Out");
+    };
+
+    void execute() override {
+      auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+      while (!stop_requested() && std::chrono::steady_clock::now() < give_up) {
+        std::this_thread::yield();
+      }
+      output_socket<int>(0)->set_current_value(
+          input_socket<int>(0)->current_value());
+    };
+  };
+
+  // 0 -> 1 -> 2 (waits) -> 3
+  qgraph::Graph g;
+  g.add_node<qgraph::ConstantNode>();
+  g.add_node<qgraph::MathNode>();
+  g.add_node<WaitingNode>();
+  g.add_node<qgraph::MathNode>();
+
+  g.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 5);
+  g.connect<int>(0, qgraph::ConstantNode::Socket::Value, 1,
+                 qgraph::MathNode::Socket::LHS);
+  g.connect<int>(1, qgraph::MathNode::Socket::RESULT, 2, 0);
+  g.connect<int>(2, 0, 3, qgraph::MathNode::Socket::LHS);
+
+  enum Mode { SERIAL, PARALLEL, VERSIONED, PARTITIONED };
+  auto mode = GENERATE(SERIAL, PARALLEL, VERSIONED, PARTITIONED);
+
+  qgraph::Evaluator eval(g);
+  qgraph::VersionedGraph versioned(g);
+  std::optional<qgraph::PartitionedEvaluator> partitioned;
+  if (mode == PARTITIONED) {
+    partitioned.emplace(g, 2);
+  }
+
+  auto evaluate = [&](const qgraph::StopCondition &stop) {
+    switch (mode) {
+    case SERIAL:
+      return eval.evaluate(stop);
+    case PARALLEL:
+      return eval.evaluate_parallel(2, qgraph::Evaluator::FIFO, stop);
+    case VERSIONED:
+      return versioned.evaluate(stop).status;
+    default:
+      return partitioned->evaluate(stop);
+    }
+  };
+
+  SECTION("Nothing runs once stopped") {
+    std::stop_source source;
+    source.request_stop();
+
+    auto status = evaluate({.token = source.get_token()});
+
+    REQUIRE(status.outcome == qgraph::EvaluationStatus::CANCELLED);
+    REQUIRE(status.completed.empty());
+    REQUIRE(status.interrupted.empty());
+  }
+
+  SECTION("Deadline interrupts a running node") {
+    auto start = std::chrono::steady_clock::now();
+    auto status =
+        evaluate({.deadline = start + std::chrono::milliseconds(20)});
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    REQUIRE(status.outcome == qgraph::EvaluationStatus::DEADLINE_EXCEEDED);
+    REQUIRE(elapsed < std::chrono::seconds(1));
+    REQUIRE(status.completed == std::vector<qgraph::NodeId>{0, 1});
+    REQUIRE(status.interrupted == std::vector<qgraph::NodeId>{2});
+    REQUIRE(g.current_output_value<int>(1, qgraph::MathNode::Socket::RESULT) ==
+            6);
+    REQUIRE(g.current_input_value<int>(3, qgraph::MathNode::Socket::LHS) == 1);
+  }
+
+  SECTION("Stop token interrupts a running node") {
+    std::stop_source source;
+    std::thread stopper([&source] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      source.request_stop();
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    auto status = evaluate({.token = source.get_token()});
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    stopper.join();
+
+    REQUIRE(status.outcome == qgraph::EvaluationStatus::CANCELLED);
+    REQUIRE(elapsed < std::chrono::seconds(1));
+    REQUIRE(status.completed == std::vector<qgraph::NodeId>{0, 1});
+    REQUIRE(status.interrupted == std::vector<qgraph::NodeId>{2});
+  }
+
+  SECTION("Nodes that do not check the stop complete") {
+    // Runs past the deadline without checking it.
+    class SleepingNode : public qgraph::Node {
+    public:
+      SleepingNode() {
+        add_input_socket<int>("In");
+        add_output_socket<int>("Out");
+      };
+
+      void execute() override {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        output_socket<int>(0)->set_current_value(
+            input_socket<int>(0)->current_value());
+      };
+    };
+
+    // 0 -> 1 (sleeps) -> 2
+    qgraph::Graph h;
+    h.add_node<qgraph::ConstantNode>();
+    h.add_node<SleepingNode>();
+    h.add_node<qgraph::MathNode>();
+    h.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 5);
+    h.connect<int>(0, qgraph::ConstantNode::Socket::Value, 1, 0);
+    h.connect<int>(1, 0, 2, qgraph::MathNode::Socket::LHS);
+
+    qgraph::Evaluator h_eval(h);
+    std::optional<qgraph::PartitionedEvaluator> h_partitioned;
+    if (mode == PARTITIONED) {
+      h_partitioned.emplace(h, 2);
+    }
+
+    qgraph::StopCondition stop{.deadline = std::chrono::steady_clock::now() +
+                                           std::chrono::milliseconds(50)};
+    auto status =
+        mode == PARALLEL ? h_eval.evaluate_parallel(2, qgraph::Evaluator::FIFO,
+                                                    stop)
+        : mode == VERSIONED
+            ? qgraph::VersionedGraph::evaluate(qgraph::Topology::of(h), stop)
+        : mode == PARTITIONED ? h_partitioned->evaluate(stop)
+                              : h_eval.evaluate(stop);
+
+    REQUIRE(status.outcome == qgraph::EvaluationStatus::DEADLINE_EXCEEDED);
+    REQUIRE(status.completed == std::vector<qgraph::NodeId>{0, 1});
+    REQUIRE(status.interrupted.empty());
+    REQUIRE(h.current_output_value<int>(1, 0) == 5);
+    if (mode != PARTITIONED) {
+      REQUIRE(h.current_input_value<int>(2, qgraph::MathNode::Socket::LHS) ==
+              5);
+    }
+  }
+
+  SECTION("Unstopped evaluations complete") {
+    qgraph::Graph h;
+    h.add_node<qgraph::MathNode>();
+    h.add_node<qgraph::MathNode>();
+    h.connect<int>(0, qgraph::MathNode::Socket::RESULT, 1,
+                   qgraph::MathNode::Socket::LHS);
+
+    qgraph::Evaluator h_eval(h);
+    auto status = mode == PARALLEL    ? h_eval.evaluate_parallel(2)
+                  : mode == VERSIONED ? qgraph::VersionedGraph::evaluate(
+                                            qgraph::Topology::of(h))
+                                      : h_eval.evaluate();
+
+    REQUIRE(status.finished());
+    REQUIRE(status.completed == std::vector<qgraph::NodeId>{0, 1});
+  }
+}
+
+TEST_CASE("Layout optimization", "[graph, layout]") {
+  // Node ids are the reverse of the execution order: 3 -> 2 -> 1 -> 0.
+  qgraph::Graph g;
+  g.add_node<qgraph::MathNode>();
+  g.add_node<qgraph::MathNode>();
+  g.add_node<qgraph::MathNode>();
+  g.add_node<qgraph::ConstantNode>();
+
+  g.set_current_output_value<int>(3, qgraph::ConstantNode::Socket::Value, 5);
+
+  g.connect<int>(3, qgraph::ConstantNode::Socket::Value, 2,
+                 qgraph::MathNode::Socket::LHS);
+  g.connect<int>(2, qgraph::MathNode::Socket::RESULT, 1,
+                 qgraph::MathNode::Socket::LHS);
+  g.connect<int>(1, qgraph::MathNode::Socket::RESULT, 0,
+                 qgraph::MathNode::Socket::LHS);
+
+  qgraph::Evaluator eval(g);
+  eval.optimize_layout();
+
+  SECTION("Nodes follow the execution order in memory") {
+    auto address = [&g](qgraph::NodeId id) {
+      return reinterpret_cast<std::uintptr_t>(g.node(id).get());
+    };
+
+    REQUIRE(address(3) < address(2));
+    REQUIRE(address(2) < address(1));
+    REQUIRE(address(1) < address(0));
+  }
+
+  SECTION("State and links survive relocation") {
+    REQUIRE(g.current_output_value<int>(
+                3, qgraph::ConstantNode::Socket::Value) == 5);
+
+    eval.evaluate();
+
+    REQUIRE(g.current_output_value<int>(0, qgraph::MathNode::Socket::RESULT) ==
+            8);
+  }
+}
+
+TEST_CASE("Relocation is opt-in", "[graph, layout]") {
+  // Keeps its output socket, so it must not be moved.
+  class CachingNode : public qgraph::Node {
+  public:
+    std::shared_ptr<qgraph::OutSocket<int>> out_;
+
+    CachingNode() {
+      add_input_socket<int>("In").with_default_value(0);
+      add_output_socket<int>("Out").with_default_value(0);
+      out_ = output_socket<int>(0);
+    };
+
+    void execute() override {
+      out_->set_current_value(input_socket<int>(0)->current_value() + 1);
+    };
+  };
+
+  qgraph::Graph g;
+  g.add_node<qgraph::ConstantNode>();
+  g.add_node<CachingNode>();
+  g.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 42);
+  g.connect<int>(0, qgraph::ConstantNode::Socket::Value, 1, 0);
+
+  qgraph::Evaluator eval(g);
+
+  SECTION("Layout optimization") {
+    auto constant = g.node(0).get();
+    auto caching = g.node(1).get();
+
+    eval.optimize_layout();
+    eval.evaluate();
+
+    REQUIRE(g.node(0).get() != constant);
+    REQUIRE(g.node(1).get() == caching);
+    REQUIRE(g.current_output_value<int>(1, 0) == 43);
+  }
+
+  SECTION("Compaction") {
+    auto constant = g.node(0)->output_socket<int>(0).get();
+    auto caching = g.node(1)->output_socket<int>(0).get();
+
+    g.compact();
+    eval.evaluate();
+
+    REQUIRE(g.node(0)->output_socket<int>(0).get() != constant);
+    REQUIRE(g.node(1)->output_socket<int>(0).get() == caching);
+    REQUIRE(g.current_output_value<int>(1, 0) == 43);
+  }
+}
+
+TEST_CASE("Compact sockets", "[graph, memory]") {
+  qgraph::Graph g;
+  g.add_node<qgraph::ConstantNode>();
+  g.add_node<qgraph::MathNode>();
+  g.add_node<qgraph::MathNode>();
+  g.add_node<qgraph::Node>();
+  g.node(3)->add_input_socket<std::string>("A").with_default_value("shared");
+  g.node(3)->add_input_socket<std::string>("B").with_default_value("shared");
+
+  g.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 5);
+  g.connect<int>(0, qgraph::ConstantNode::Socket::Value, 1,
+                 qgraph::MathNode::Socket::LHS);
+  g.connect<int>(1, qgraph::MathNode::Socket::RESULT, 2,
+                 qgraph::MathNode::Socket::LHS);
+
+  auto before = g.memory_stats();
+
+  REQUIRE(before.nodes > 0);
+  REQUIRE(before.sockets > 0);
+  REQUIRE(before.labels > 0);
+  REQUIRE(before.links > 0);
+  REQUIRE(before.values > 0);
+
+  g.compact();
+  auto after = g.memory_stats();
+
+  REQUIRE(after.total() < before.total());
+  REQUIRE(after.sockets < before.sockets);
+  REQUIRE(after.labels < before.labels);
+  REQUIRE(after.values < before.values);
+
+  SECTION("Values, defaults and links are kept") {
+    REQUIRE(g.current_output_value<int>(
+                0, qgraph::ConstantNode::Socket::Value) == 5);
+    REQUIRE(g.default_input_value<int>(1, qgraph::MathNode::Socket::RHS) ==
+            1);
+
+    qgraph::Evaluator eval(g);
+    eval.evaluate();
+
+    REQUIRE(g.current_output_value<int>(2, qgraph::MathNode::Socket::RESULT) ==
+            7);
+  }
+
+  SECTION("Sockets can still be found by label") {
+    REQUIRE(g.node(1)->get_input_socket<int>("A").value() ==
+            g.node(1)->input_socket<int>(0));
+    REQUIRE(g.node(1)->get_output_socket<int>("C").value() ==
+            g.node(1)->output_socket<int>(0));
+    REQUIRE_FALSE(g.node(1)->get_input_socket<int>("C").has_value());
+
+    g.add_node<qgraph::MathNode>();
+    g.connect_deprecated<int>(2, "C", 4, "A");
+
+    qgraph::Evaluator eval(g);
+    eval.evaluate();
+
+    REQUIRE(g.current_output_value<int>(4, qgraph::MathNode::Socket::RESULT) ==
+            8);
+  }
+
+  SECTION("Sockets can be added afterwards") {
+    g.node(1)->add_input_socket<int>("D");
+
+    REQUIRE(g.node(1)->get_input_socket<int>("A").has_value());
+    REQUIRE(g.node(1)->get_input_socket<int>("D").value() ==
+            g.node(1)->input_socket<int>(2));
+    REQUIRE_THROWS(g.node(1)->add_input_socket<int>("A"));
+  }
+
+  SECTION("Equal defaults are shared") {
+    REQUIRE(&g.default_input_value<std::string>(3, 0) ==
+            &g.default_input_value<std::string>(3, 1));
+  }
+
+  SECTION("Compacted sockets can still be relocated") {
+    qgraph::Evaluator eval(g);
+    eval.optimize_layout();
+    eval.evaluate();
+
+    REQUIRE(g.current_output_value<int>(2, qgraph::MathNode::Socket::RESULT) ==
+            7);
+    REQUIRE(g.memory_stats().sockets > after.sockets);
+  }
+}
+
+TEST_CASE("Edit transactions", "[graph, edit]") {
+  using qgraph::MathNode;
+
+  qgraph::Graph g;
+  g.add_node<MathNode>();
+  g.add_node<MathNode>();
+  g.connect<int>(0, MathNode::Socket::RESULT, 1, MathNode::Socket::LHS);
+
+  REQUIRE(g.committed_order() == nullptr);
+
+  SECTION("Changes are applied on commit") {
+    auto edit = g.begin_edit();
+    auto id = edit.add_node<MathNode>();
+    edit.connect<int>(1, MathNode::Socket::RESULT, id, MathNode::Socket::LHS);
+
+    REQUIRE(id == 2);
+    REQUIRE(g.num_of_nodes() == 2);
+
+    edit.commit();
+
+    REQUIRE(g.num_of_nodes() == 3);
+    REQUIRE(*g.committed_order() == std::vector<qgraph::NodeId>{0, 1, 2});
+    REQUIRE(g.node(2)->input_socket<int>(MathNode::Socket::LHS)->source() ==
+            std::pair<qgraph::NodeId, qgraph::SocketId>{1, 0});
+
+    qgraph::Evaluator eval(g);
+    eval.evaluate();
+
+    REQUIRE(g.current_output_value<int>(2, MathNode::Socket::RESULT) == 4);
+    REQUIRE_THROWS_AS(edit.add_node<MathNode>(), std::runtime_error);
+
+    g.add_node<MathNode>();
+    REQUIRE(g.committed_order() == nullptr);
+  }
+
+  SECTION("Outputs are sized once for all their added links") {
+    auto edit = g.begin_edit();
+    for (int i = 0; i < 5; ++i) {
+      auto id = edit.add_node<MathNode>();
+      edit.connect<int>(0, MathNode::Socket::RESULT, id,
+                        MathNode::Socket::LHS);
+    }
+    edit.commit();
+
+    const auto &links = g.node(0)->output_socket<int>(0)->connected_to();
+    REQUIRE(links.size() == 6);
+    REQUIRE(links.capacity() == 6);
+    REQUIRE(std::is_sorted(links.begin(), links.end()));
+  }
+
+  SECTION("Links changed through sockets discard the committed order") {
+    g.begin_edit().commit();
+    REQUIRE(*g.committed_order() == std::vector<qgraph::NodeId>{0, 1});
+
+    g.node(1)->output_socket<int>(0)->connect(0, MathNode::Socket::RHS);
+    g.node(0)->input_socket<int>(MathNode::Socket::RHS)->connect(1, 0);
+    REQUIRE(g.committed_order() == nullptr);
+  }
+
+  SECTION("Only changes to the same graph discard the committed order") {
+    g.begin_edit().commit();
+
+    qgraph::Graph other;
+    other.add_node<MathNode>();
+    other.add_node<MathNode>();
+    other.connect<int>(0, MathNode::Socket::RESULT, 1, MathNode::Socket::LHS);
+    REQUIRE(g.committed_order() != nullptr);
+
+    g.node(1)->add_input_socket<int>("C");
+    REQUIRE(g.committed_order() == nullptr);
+  }
+
+  SECTION("Cycles roll the whole edit back") {
+    auto edit = g.begin_edit();
+    edit.add_node<MathNode>();
+    edit.connect<int>(1, MathNode::Socket::RESULT, 2, MathNode::Socket::LHS);
+    edit.connect<int>(2, MathNode::Socket::RESULT, 0, MathNode::Socket::RHS);
+
+    REQUIRE_THROWS_AS(edit.commit(), std::invalid_argument);
+    REQUIRE(g.num_of_nodes() == 2);
+    REQUIRE(g.node(1)->output_socket<int>(0)->connected_to().empty());
+    REQUIRE_FALSE(
+        g.node(0)->input_socket<int>(MathNode::Socket::RHS)->source());
+  }
+
+  SECTION("Links into an input replace the previous one") {
+    auto edit = g.begin_edit();
+    auto id = edit.add_node<MathNode>();
+    edit.connect<int>(id, MathNode::Socket::RESULT, 1, MathNode::Socket::LHS);
+    edit.commit();
+
+    REQUIRE(g.node(0)->output_socket<int>(0)->connected_to().empty());
+    REQUIRE(g.node(2)->output_socket<int>(0)->connected_to().size() == 1);
+  }
+
+  SECTION("Disconnected links are removed from both ends") {
+    auto edit = g.begin_edit();
+    edit.disconnect(0, MathNode::Socket::RESULT, 1, MathNode::Socket::LHS);
+    edit.commit();
+
+    REQUIRE(g.node(0)->output_socket<int>(0)->connected_to().empty());
+    REQUIRE_FALSE(
+        g.node(1)->input_socket<int>(MathNode::Socket::LHS)->source());
+  }
+
+  SECTION("Removing nodes renumbers later nodes") {
+    auto edit = g.begin_edit();
+    auto id = edit.add_node<MathNode>();
+    edit.connect<int>(1, MathNode::Socket::RESULT, id, MathNode::Socket::LHS);
+    edit.remove_node(0);
+    edit.commit();
+
+    REQUIRE(g.num_of_nodes() == 2);
+    REQUIRE(g.node(0)->id() == 0);
+    REQUIRE(g.node(1)->id() == 1);
+    REQUIRE_FALSE(
+        g.node(0)->input_socket<int>(MathNode::Socket::LHS)->source());
+    REQUIRE(g.node(1)->input_socket<int>(MathNode::Socket::LHS)->source() ==
+            std::pair<qgraph::NodeId, qgraph::SocketId>{0, 0});
+
+    auto links = g.node(0)->output_socket<int>(0)->connected_to();
+    REQUIRE(links.size() == 1);
+    REQUIRE(links[0].destination_node == 1);
+  }
+
+  SECTION("Links added from removed nodes are dropped") {
+    auto edit = g.begin_edit();
+    auto id = edit.add_node<MathNode>();
+    edit.connect<int>(id, MathNode::Socket::RESULT, 1, MathNode::Socket::LHS);
+    edit.remove_node(id);
+    edit.commit();
+
+    REQUIRE(g.num_of_nodes() == 2);
+    REQUIRE(g.node(0)->output_socket<int>(0)->connected_to().empty());
+    REQUIRE_FALSE(
+        g.node(1)->input_socket<int>(MathNode::Socket::LHS)->source());
+  }
+
+  SECTION("Wrong ids and types roll the whole edit back") {
+    auto edit = g.begin_edit();
+    auto id = edit.add_node<qgraph::IncrNode>();
+    edit.connect<int>(1, MathNode::Socket::RESULT, id,
+                      qgraph::IncrNode::Socket::VALUE);
+    edit.connect<int>(0, MathNode::Socket::RESULT, id,
+                      qgraph::IncrNode::Socket::CONDITION);
+
+    REQUIRE_THROWS_AS(edit.commit(), std::invalid_argument);
+    REQUIRE(g.num_of_nodes() == 2);
+    REQUIRE(g.node(0)->output_socket<int>(0)->connected_to().size() == 1);
+    REQUIRE(g.node(1)->output_socket<int>(0)->connected_to().empty());
+
+    auto bad_socket = g.begin_edit();
+    bad_socket.connect<int>(0, 5, 1, 0);
+    REQUIRE_THROWS_AS(bad_socket.commit(), std::out_of_range);
+
+    auto bad_node = g.begin_edit();
+    bad_node.connect<int>(0, 0, 9, 0);
+    REQUIRE_THROWS_AS(bad_node.commit(), std::out_of_range);
+    REQUIRE(g.node(0)->output_socket<int>(0)->connected_to().size() == 1);
+  }
+}
+
+TEST_CASE("Versioned topology", "[graph, snapshot]") {
+  qgraph::VersionedGraph g;
+
+  {
+    auto edit = g.edit();
+    edit.add_node<qgraph::MathNode>();
+    edit.add_node<qgraph::MathNode>();
+    edit.connect<int>(0, qgraph::MathNode::Socket::RESULT, 1,
+                      qgraph::MathNode::Socket::LHS);
+    edit.commit();
+  }
+
+  auto before = g.snapshot();
+
+  REQUIRE(before->num_of_nodes() == 2);
+
+  SECTION("Published snapshots are immutable") {
+    auto edit = g.edit();
+    edit.add_node<qgraph::MathNode>();
+    edit.connect<int>(1, qgraph::MathNode::Socket::RESULT, 2,
+                      qgraph::MathNode::Socket::LHS);
+    edit.commit();
+
+    REQUIRE(before->num_of_nodes() == 2);
+    REQUIRE(before->links_of(1).empty());
+    REQUIRE(g.snapshot()->num_of_nodes() == 3);
+
+    g.evaluate();
+
+    REQUIRE(g.snapshot()
+                ->node(2)
+                ->output_socket<int>(qgraph::MathNode::Socket::RESULT)
+                ->current_value() == 4);
+  }
+
+  SECTION("Untouched links are shared with the previous version") {
+    auto edit = g.edit();
+    edit.add_node<qgraph::MathNode>();
+    edit.connect<int>(1, qgraph::MathNode::Socket::RESULT, 2,
+                      qgraph::MathNode::Socket::LHS);
+    edit.commit();
+
+    auto after = g.snapshot();
+    REQUIRE(after->links[0] == before->links[0]);
+    REQUIRE(after->links[1] != before->links[1]);
+    REQUIRE(after->order == std::vector<qgraph::NodeId>{0, 1, 2});
+  }
+
+  SECTION("Links against the order sort the topology again") {
+    auto edit = g.edit();
+    auto id = edit.add_node<qgraph::MathNode>();
+    edit.connect<int>(id, qgraph::MathNode::Socket::RESULT, 0,
+                      qgraph::MathNode::Socket::LHS);
+    edit.commit();
+
+    const auto &order = g.snapshot()->order;
+    REQUIRE(order == std::vector<qgraph::NodeId>{2, 0, 1});
+  }
+
+  SECTION("Links into an input replace the previous one") {
+    auto edit = g.edit();
+    edit.add_node<qgraph::MathNode>();
+    edit.connect<int>(2, qgraph::MathNode::Socket::RESULT, 1,
+                      qgraph::MathNode::Socket::LHS);
+    edit.disconnect_input(1, qgraph::MathNode::Socket::LHS);
+    edit.connect<int>(0, qgraph::MathNode::Socket::RESULT, 1,
+                      qgraph::MathNode::Socket::LHS);
+    edit.commit();
+
+    auto after = g.snapshot();
+    REQUIRE(after->links_of(0).size() == 1);
+    REQUIRE(after->links_of(2).empty());
+    REQUIRE(before->links_of(0).size() == 1);
+  }
+
+  SECTION("Old snapshots are released once unused") {
+    std::weak_ptr<const qgraph::Topology> old = before;
+    before.reset();
+
+    auto edit = g.edit();
+    edit.add_node<qgraph::MathNode>();
+    edit.commit();
+
+    REQUIRE(old.expired());
+  }
+
+  SECTION("Cycles are rejected on commit") {
+    auto edit = g.edit();
+    edit.connect<int>(1, qgraph::MathNode::Socket::RESULT, 0,
+                      qgraph::MathNode::Socket::LHS);
+
+    REQUIRE_THROWS_AS(edit.commit(), std::invalid_argument);
+    REQUIRE(g.snapshot() == before);
+  }
+
+  SECTION("Uncommitted edits are discarded") {
+    {
+      auto edit = g.edit();
+      edit.add_node<qgraph::MathNode>();
+    }
+
+    REQUIRE(g.snapshot() == before);
+  }
+}
+
+TEST_CASE("Editing during evaluation", "[graph, snapshot]") {
+  qgraph::Graph base;
+  base.add_node<qgraph::ConstantNode>();
+  base.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 1);
+
+  qgraph::VersionedGraph g(base);
+
+  std::atomic<bool> done = false;
+
+  std::thread editor([&] {
+    // Grow a chain 0 -> 1 -> ... -> 200 one node at a time.
+    for (qgraph::NodeId i = 1; i <= 200; ++i) {
+      auto edit = g.edit();
+      edit.add_node<qgraph::MathNode>();
+      edit.connect<int>(i - 1, 0, i, qgraph::MathNode::Socket::LHS);
+      edit.commit();
+    }
+    done = true;
+  });
+
+  size_t evaluations = 0;
+  while (!done) {
+    auto [topology, status] = g.evaluate();
+    REQUIRE(topology->order.size() == topology->num_of_nodes());
+    REQUIRE(status.finished());
+    evaluations++;
+  }
+  editor.join();
+
+  g.evaluate();
+
+  // Each math node adds its default right hand side of 1.
+  REQUIRE(g.snapshot()->node(200)->output_socket<int>(0)->current_value() ==
+          201);
+  REQUIRE(evaluations > 0);
+}
+
+TEST_CASE("Graph partitioning", "[graph, partition]") {
+  // Two independent chains of four nodes each.
+  qgraph::Graph g;
+  for (qgraph::NodeId i = 0; i < 8; ++i) {
+    g.add_node<qgraph::MathNode>();
+    if (i % 4 != 0) {
+      g.connect<int>(i - 1, qgraph::MathNode::Socket::RESULT, i,
+                     qgraph::MathNode::Socket::LHS);
+    }
+  }
+
+  auto parts = qgraph::partition(qgraph::Topology::of(g), 2);
+
+  REQUIRE(parts.cut_links == 0);
+  REQUIRE(parts.size_of(0) == 4);
+  REQUIRE(parts.size_of(1) == 4);
+  REQUIRE(parts.part_of[0] == parts.part_of[3]);
+  REQUIRE(parts.part_of[4] == parts.part_of[7]);
+}
+
+TEST_CASE("Shared ring", "[partition]") {
+  alignas(64) std::byte memory[1024];
+  REQUIRE(qgraph::SharedRing::bytes_needed(3, sizeof(int)) <= sizeof(memory));
+
+  auto ring = qgraph::SharedRing::create(memory, 3, sizeof(int));
+
+  REQUIRE(ring.front() == nullptr);
+
+  // Capacity is rounded up to four messages.
+  for (int i = 0; i < 4; ++i) {
+    REQUIRE(ring.try_push(i, &i, sizeof(i)));
+  }
+  int extra = 4;
+  REQUIRE_FALSE(ring.try_push(4, &extra, sizeof(extra)));
+
+  for (std::uint32_t i = 0; i < 4; ++i) {
+    auto message = ring.front();
+    REQUIRE(message != nullptr);
+    REQUIRE(message->key == i);
+    REQUIRE(*static_cast<const int *>(message->data()) == static_cast<int>(i));
+    ring.pop();
+  }
+
+  REQUIRE(ring.front() == nullptr);
+}
+
+TEST_CASE("Partitioned evaluation", "[graph, partition]") {
+  // A chain of six nodes split in two processes. Each node adds
+  // the result of the previous one and its default of 1.
+  qgraph::Graph g;
+  for (qgraph::NodeId i = 0; i < 6; ++i) {
+    g.add_node<qgraph::MathNode>();
+    if (i > 0) {
+      g.connect<int>(i - 1, qgraph::MathNode::Socket::RESULT, i,
+                     qgraph::MathNode::Socket::LHS);
+    }
+  }
+
+  qgraph::PartitionedEvaluator eval(g, 2);
+
+  REQUIRE(eval.partition().cut_links == 1);
+
+  eval.evaluate();
+  eval.evaluate();
+
+  REQUIRE(g.current_output_value<int>(5, qgraph::MathNode::Socket::RESULT) ==
+          7);
+  REQUIRE(g.current_output_value<int>(2, qgraph::MathNode::Socket::RESULT) ==
+          4);
+
+  for (qgraph::NodeId i = 0; i < 6; ++i) {
+    REQUIRE(eval.node_cost(i) >= 0);
+  }
+  REQUIRE(eval.peak_memory(0) > 0);
+  REQUIRE(eval.peak_memory(1) > 0);
+  REQUIRE_THROWS_AS(eval.peak_memory(2), std::out_of_range);
+
+  SECTION("Values written after construction reach the workers") {
+    g.set_current_input_value<int>(0, qgraph::MathNode::Socket::LHS, 10);
+    eval.evaluate();
+
+    REQUIRE(g.current_output_value<int>(5, qgraph::MathNode::Socket::RESULT) ==
+            16);
+
+    g.set_current_input_value<int>(4, qgraph::MathNode::Socket::RHS, 5);
+    eval.evaluate();
+
+    REQUIRE(g.current_output_value<int>(5, qgraph::MathNode::Socket::RESULT) ==
+            20);
+  }
+}
+
+TEST_CASE("Partitioned evaluation of serialized values", "[graph, partition]") {
+  class AppendNode : public qgraph::Node {
+  public:
+    AppendNode() {
+      add_input_socket<std::string>("In");
+      add_output_socket<std::string>("Out");
+    };
+
+    void execute() override {
+      output_socket<std::string>(0)->set_current_value(
+          input_socket<std::string>(0)->current_value() + "x");
+    };
+  };
+
+  qgraph::Graph g;
+  for (qgraph::NodeId i = 0; i < 4; ++i) {
+    g.add_node<AppendNode>();
+    if (i > 0) {
+      g.connect<std::string>(i - 1, 0, i, 0);
+    }
+  }
+
+  qgraph::PartitionedEvaluator eval(g, 2);
+  REQUIRE(eval.partition().cut_links == 1);
+
+  eval.evaluate();
+  REQUIRE(g.current_output_value<std::string>(3, 0) == "xxxx");
+
+  // Larger than a ring slot.
+  std::string text(1000, 'a');
+  g.set_current_input_value<std::string>(0, 0, text);
+  eval.evaluate();
+  REQUIRE(g.current_output_value<std::string>(3, 0) == text + "xxxx");
+}
+
+TEST_CASE("Partitioned evaluation failures", "[graph, partition]") {
+  SECTION("Links between parts must carry sendable values") {
+    qgraph::Graph g;
+    for (qgraph::NodeId i = 0; i < 4; ++i) {
+      g.add_node<qgraph::Node>();
+      g.node(i)->add_input_socket<std::set<int>>("In");
+      g.node(i)->add_output_socket<std::set<int>>("Out");
+      if (i > 0) {
+        g.connect<std::set<int>>(i - 1, 0, i, 0);
+      }
+    }
+
+    REQUIRE_THROWS_AS(qgraph::PartitionedEvaluator(g, 2),
+                      std::invalid_argument);
+  }
+
+  SECTION("Written values must be sendable") {
+    qgraph::Graph g;
+    g.add_node<qgraph::MathNode>();
+    g.add_node<qgraph::MathNode>();
+    g.node(0)->add_input_socket<std::set<int>>("Tags");
+
+    qgraph::PartitionedEvaluator eval(g, 2);
+    eval.evaluate();
+
+    g.set_current_input_value<std::set<int>>(0, 2, {1, 2});
+    REQUIRE_THROWS_AS(eval.evaluate(), std::invalid_argument);
+  }
+
+  SECTION("A crashing worker is reported") {
+    class CrashingNode : public qgraph::Node {
+    public:
+      void execute() override { _exit(3); };
+    };
+
+    qgraph::Graph g;
+    g.add_node<CrashingNode>();
+    g.add_node<qgraph::MathNode>();
+
+    qgraph::PartitionedEvaluator eval(g, 2);
+
+    REQUIRE_THROWS_AS(eval.evaluate(), std::runtime_error);
+    REQUIRE_THROWS_AS(eval.evaluate(), std::runtime_error);
+  }
+}
+
+TEST_CASE("Checkpoints", "[graph, checkpoint]") {
+  qgraph::Graph g;
+  g.add_node<qgraph::ConstantNode>();
+  g.add_node<qgraph::MathNode>();
+  g.add_node<qgraph::Node>();
+  g.node(2)->add_output_socket<std::string>("Name").with_default_value("a");
+
+  g.connect<int>(0, qgraph::ConstantNode::Socket::Value, 1,
+                 qgraph::MathNode::Socket::LHS);
+
+  g.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 10);
+
+  qgraph::Evaluator eval(g);
+  eval.evaluate();
+
+  auto saved = g.checkpoint();
+
+  REQUIRE_FALSE(saved.incremental);
+  REQUIRE(saved.entries.size() == 5);
+
+  g.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 20);
+  g.set_current_output_value<std::string>(2, 0, "b");
+  eval.evaluate();
+
+  REQUIRE(g.current_output_value<int>(1, qgraph::MathNode::Socket::RESULT) ==
+          21);
+
+  SECTION("Restore rolls every value back") {
+    g.restore(saved);
+
+    REQUIRE(g.current_output_value<int>(
+                0, qgraph::ConstantNode::Socket::Value) == 10);
+    REQUIRE(g.current_input_value<int>(1, qgraph::MathNode::Socket::LHS) ==
+            10);
+    REQUIRE(g.current_output_value<int>(1, qgraph::MathNode::Socket::RESULT) ==
+            11);
+    REQUIRE(g.current_output_value<std::string>(2, 0) == "a");
+  }
+
+  SECTION("Incremental checkpoints hold changed sockets only") {
+    auto base = g.checkpoint();
+
+    g.set_current_output_value<std::string>(2, 0, "c");
+    auto delta = g.checkpoint(base);
+
+    REQUIRE(delta.incremental);
+    REQUIRE(delta.entries.size() == 1);
+    REQUIRE(delta.entries[0].node == 2);
+
+    g.restore(saved);
+    g.restore(base);
+    g.restore(delta);
+
+    REQUIRE(g.current_output_value<int>(1, qgraph::MathNode::Socket::RESULT) ==
+            21);
+    REQUIRE(g.current_output_value<std::string>(2, 0) == "c");
+  }
+
+  SECTION("Sockets added since are saved incrementally") {
+    auto base = g.checkpoint();
+
+    g.node(0)->add_output_socket<int>("Extra");
+    g.set_current_output_value<std::string>(2, 0, "c");
+    auto delta = g.checkpoint(base);
+
+    REQUIRE(delta.entries.size() == 2);
+    REQUIRE(delta.entries[0].node == 0);
+    REQUIRE(delta.entries[0].socket == 1);
+    REQUIRE(delta.entries[1].node == 2);
+  }
+
+  SECTION("Removing nodes saves every socket incrementally") {
+    auto base = g.checkpoint();
+
+    g.delete_node(1);
+
+    REQUIRE(g.checkpoint(base).entries.size() == 2);
+  }
+
+  SECTION("Writing an equal value is not a change") {
+    auto base = g.checkpoint();
+
+    g.set_current_output_value<int>(0, qgraph::ConstantNode::Socket::Value, 20);
+    eval.evaluate();
+
+    REQUIRE(g.checkpoint(base).entries.empty());
+  }
+
+  SECTION("Empty values are restored") {
+    g.node(2)->add_output_socket<std::vector<int>>("Items");
+    g.set_current_output_value<std::string>(2, 0, "");
+    auto empty = g.checkpoint();
+
+    g.set_current_output_value<std::string>(2, 0, "d");
+    g.set_current_output_value<std::vector<int>>(2, 1, {1, 2});
+    g.restore(empty);
+
+    REQUIRE(g.current_output_value<std::string>(2, 0).empty());
+    REQUIRE(g.current_output_value<std::vector<int>>(2, 1).empty());
+  }
+
+  SECTION("Bool vectors are saved element by element") {
+    g.node(2)->add_output_socket<std::vector<bool>>("Flags");
+    g.set_current_output_value<std::vector<bool>>(2, 1, {true, false, true});
+    auto flags = g.checkpoint();
+
+    g.set_current_output_value<std::vector<bool>>(2, 1, {false});
+    g.restore(flags);
+
+    REQUIRE(g.current_output_value<std::vector<bool>>(2, 1) ==
+            std::vector<bool>{true, false, true});
+  }
+
+  SECTION("Checkpoints can be written and read back") {
+    std::stringstream stream;
+    saved.write(stream);
+
+    // Header, then entries without padding.
+    auto entry_size = sizeof(qgraph::NodeId) + sizeof(qgraph::SocketId) + 1 +
+                      2 * sizeof(std::uint64_t);
+    REQUIRE(stream.str().size() == 4 * sizeof(std::uint64_t) +
+                                       saved.entries.size() * entry_size +
+                                       saved.data.size());
+
+    g.restore(qgraph::Checkpoint::read(stream));
+
+    REQUIRE(g.current_output_value<int>(1, qgraph::MathNode::Socket::RESULT) ==
+            11);
+    REQUIRE(g.current_output_value<std::string>(2, 0) == "a");
+  }
+
+  SECTION("Values without serializer are rejected") {
+    struct Opaque {
+      std::string name;
+    };
+
+    g.node(2)->add_input_socket<Opaque>("Opaque");
+
+    REQUIRE_THROWS_AS(g.checkpoint(), std::invalid_argument);
+  }
+}
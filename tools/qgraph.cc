@@ -1,7 +1,25 @@
-#include "QGraph/qgraph.hh"
 #include "QGraph/qevaluator.hh"
+#include "QGraph/qgraph.hh"
 #include "QGraph/qnode.hh"
-#include <cassert>
+#include "QGraph/qpartition.hh"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <vector>
 
 class ConstantNode : public qgraph::Node {
 public:
@@ -36,8 +54,9 @@ public:
   };
 
   void execute() override {
-    auto a = input_socket<int>(Socket::LHS)->current_value();
-    auto b = input_socket<int>(Socket::RHS)->current_value();
+    // Wraps around instead of overflowing on large generated graphs.
+    unsigned a = input_socket<int>(Socket::LHS)->current_value();
+    unsigned b = input_socket<int>(Socket::RHS)->current_value();
     switch (this->operation) {
 
     case SUM:
@@ -53,28 +72,509 @@ public:
   };
 };
 
-int main() {
+// Sums its inputs after spinning for a fixed number of iterations,
+// standing in for nodes doing real work.
+class WorkNode : public MathNode {
+private:
+  std::uint64_t iterations_;
+  std::uint64_t state_ = 1;
+
+public:
+  WorkNode(std::uint64_t iterations) : iterations_(iterations) {};
+
+  void execute() override {
+    for (std::uint64_t i = 0; i < iterations_; ++i) {
+      state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    MathNode::execute();
+  };
+};
+
+// Graph as read from a file or generated, before it is built.
+//
+// Files hold one node or link per line; nodes are numbered in the
+// order they appear and `#` starts a comment:
+//
+//   constant <value>
+//   math sum|sub|mul
+//   work <iterations>
+//   link <from node> <output socket> <to node> <input socket>
+struct GraphSpec {
+  struct NodeSpec {
+    std::string kind;
+    std::string argument;
+  };
+
+  struct LinkSpec {
+    qgraph::NodeId from;
+    qgraph::SocketId output;
+    qgraph::NodeId to;
+    qgraph::SocketId input;
+  };
+
+  std::string name;
+  std::vector<NodeSpec> nodes;
+  std::vector<LinkSpec> links;
+};
+
+template <typename T>
+static T parse_number(std::string_view text, std::string_view what) {
+  T value{};
+  auto last = text.data() + text.size();
+  auto [end, error] = std::from_chars(text.data(), last, value);
+  if (error != std::errc() || end != last) {
+    throw std::invalid_argument("Invalid " + std::string(what) + " <" +
+                                std::string(text) + ">");
+  }
+  return value;
+};
+
+static MathNode::Operation parse_operation(std::string_view text) {
+  if (text == "sum") {
+    return MathNode::SUM;
+  } else if (text == "sub") {
+    return MathNode::SUB;
+  } else if (text == "mul") {
+    return MathNode::MUL;
+  }
+  throw std::invalid_argument("Unknown math operation <" + std::string(text) +
+                              ">");
+};
+
+// Throws if the argument of a node is invalid.
+static void check_node(const GraphSpec::NodeSpec &node) {
+  if (node.kind == "constant") {
+    parse_number<int>(node.argument, "value");
+  } else if (node.kind == "math") {
+    parse_operation(node.argument);
+  } else {
+    parse_number<std::uint64_t>(node.argument, "iterations");
+  }
+};
+
+static GraphSpec read_graph(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("Cannot open " + path);
+  }
+
+  GraphSpec spec;
+  spec.name = path;
+
+  std::string line;
+  for (size_t number = 1; std::getline(file, line); ++number) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream words(line);
+    std::vector<std::string> fields;
+    for (std::string word; words >> word;) {
+      fields.push_back(word);
+    }
+
+    try {
+      if (fields.empty()) {
+        continue;
+      } else if (fields[0] == "link" && fields.size() == 5) {
+        using qgraph::NodeId, qgraph::SocketId;
+        spec.links.push_back({parse_number<NodeId>(fields[1], "node"),
+                              parse_number<SocketId>(fields[2], "socket"),
+                              parse_number<NodeId>(fields[3], "node"),
+                              parse_number<SocketId>(fields[4], "socket")});
+      } else if (fields.size() == 2 &&
+                 (fields[0] == "constant" || fields[0] == "math" ||
+                  fields[0] == "work")) {
+        spec.nodes.push_back({fields[0], fields[1]});
+        check_node(spec.nodes.back());
+      } else {
+        throw std::invalid_argument("Unknown entry <" + line + ">");
+      }
+    } catch (const std::invalid_argument &error) {
+      throw std::invalid_argument(path + ":" + std::to_string(number) + ": " +
+                                  error.what());
+    }
+  }
+
+  return spec;
+};
+
+static void write_graph(const GraphSpec &spec, const std::string &path) {
+  std::ofstream file(path);
+  file << "# Written by qgraph from " << spec.name << "\n";
+  for (const auto &node : spec.nodes) {
+    file << node.kind << " " << node.argument << "\n";
+  }
+  for (const auto &link : spec.links) {
+    file << "link " << link.from << " " << link.output << " " << link.to << " "
+         << link.input << "\n";
+  }
+  if (!file) {
+    throw std::runtime_error("Cannot write " + path);
+  }
+};
+
+// Generates a graph of `size` nodes. Nodes without inputs are
+// constants and every other node adds up two earlier nodes.
+static GraphSpec generate_graph(const std::string &shape, size_t size,
+                                std::uint64_t work, std::uint32_t seed) {
+  if (size == 0 || size >= std::numeric_limits<qgraph::NodeId>::max()) {
+    throw std::invalid_argument("Invalid number of nodes " +
+                                std::to_string(size));
+  }
+
+  GraphSpec spec;
+  spec.name = shape;
+
+  // Sources of every node, or none for constants.
+  std::vector<std::vector<qgraph::NodeId>> sources(size);
+
+  if (shape == "chain") {
+    for (size_t id = 1; id < size; ++id) {
+      sources[id] = {static_cast<qgraph::NodeId>(id - 1)};
+    }
+  } else if (shape == "layers") {
+    auto width = std::max<size_t>(1, std::sqrt(static_cast<double>(size)));
+    for (size_t id = width; id < size; ++id) {
+      auto layer = id / width * width - width;
+      sources[id] = {static_cast<qgraph::NodeId>(layer + id % width),
+                     static_cast<qgraph::NodeId>(layer + (id + 1) % width)};
+    }
+  } else if (shape == "tree") {
+    // Binary reduction towards the last node, leaves first.
+    for (size_t heap = 0; 2 * heap + 1 < size; ++heap) {
+      auto &inputs = sources[size - 1 - heap];
+      for (auto child : {2 * heap + 1, 2 * heap + 2}) {
+        if (child < size) {
+          inputs.push_back(static_cast<qgraph::NodeId>(size - 1 - child));
+        }
+      }
+    }
+  } else if (shape == "random") {
+    std::mt19937 random(seed);
+    for (size_t id = 1; id < size; ++id) {
+      std::uniform_int_distribution<size_t> earlier(0, id - 1);
+      sources[id] = {static_cast<qgraph::NodeId>(earlier(random)),
+                     static_cast<qgraph::NodeId>(earlier(random))};
+    }
+  } else {
+    throw std::invalid_argument("Unknown shape <" + shape + ">");
+  }
+
+  for (size_t id = 0; id < size; ++id) {
+    if (sources[id].empty()) {
+      spec.nodes.push_back({"constant", "1"});
+    } else if (work == 0) {
+      spec.nodes.push_back({"math", "sum"});
+    } else {
+      spec.nodes.push_back({"work", std::to_string(work)});
+    }
+
+    for (size_t input = 0; input < sources[id].size(); ++input) {
+      spec.links.push_back({sources[id][input], MathNode::RESULT,
+                            static_cast<qgraph::NodeId>(id),
+                            static_cast<qgraph::SocketId>(input)});
+    }
+  }
+
+  return spec;
+};
+
+static void build_graph(const GraphSpec &spec, qgraph::Graph &graph) {
+  auto edit = graph.begin_edit();
+  edit.reserve(spec.nodes.size(), spec.links.size());
+
+  for (const auto &node : spec.nodes) {
+    if (node.kind == "constant") {
+      edit.add_node<ConstantNode>(parse_number<int>(node.argument, "value"));
+    } else if (node.kind == "math") {
+      edit.add_node<MathNode>(parse_operation(node.argument));
+    } else {
+      edit.add_node<WorkNode>(
+          parse_number<std::uint64_t>(node.argument, "iterations"));
+    }
+  }
+
+  for (const auto &link : spec.links) {
+    edit.connect<int>(link.from, link.output, link.to, link.input);
+  }
+
+  // Checks ids and cycles.
+  edit.commit();
+};
+
+struct Options {
+  std::optional<std::string> file;
+  std::optional<std::string> shape;
+  size_t nodes = 1000;
+  std::uint64_t work = 0;
+  std::uint32_t seed = 1;
+  std::optional<std::string> write;
+
+  std::string mode = "serial";
+  size_t threads = 4;
+  qgraph::Evaluator::Schedule schedule = qgraph::Evaluator::CRITICAL_PATH;
+  size_t iterations = 100;
+  size_t batch = 1;
+  size_t top = 10;
+};
+
+static constexpr const char *usage = R"(
+Usage: qgraph [FILE | --generate SHAPE] [options]
+
+Loads the graph in FILE, or generates one, evaluates it repeatedly and
+reports latency, throughput, the most expensive nodes and peak memory.
+
+Graph:
+  --generate SHAPE  chain, layers, tree or random
+  --nodes N         nodes of the generated graph (default 1000)
+  --work N          busy loop iterations of generated nodes (default 0)
+  --seed N          seed of random graphs (default 1)
+  --write FILE      write the graph to FILE before running it
+
+Evaluation:
+  --mode MODE       serial, parallel or partitioned (default serial)
+  --threads N       threads, or worker processes if partitioned (default 4)
+  --schedule S      fifo or critical, for parallel mode (default critical)
+  --iterations N    timed samples (default 100)
+  --batch N         evaluations per sample, whose mean latency is
+                    reported (default 1)
+  --top N           most expensive nodes to list (default 10)
+)";
+
+static Options parse_options(int argc, char **argv) {
+  Options options;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (!arg.starts_with("--")) {
+      options.file = arg;
+      continue;
+    }
+    if (i + 1 == argc) {
+      throw std::invalid_argument("Missing value for " + std::string(arg));
+    }
+    std::string_view value = argv[++i];
+
+    if (arg == "--generate") {
+      options.shape = value;
+    } else if (arg == "--nodes") {
+      options.nodes = parse_number<size_t>(value, "number of nodes");
+    } else if (arg == "--work") {
+      options.work = parse_number<std::uint64_t>(value, "work");
+    } else if (arg == "--seed") {
+      options.seed = parse_number<std::uint32_t>(value, "seed");
+    } else if (arg == "--write") {
+      options.write = value;
+    } else if (arg == "--mode") {
+      options.mode = value;
+    } else if (arg == "--threads") {
+      options.threads = parse_number<size_t>(value, "number of threads");
+    } else if (arg == "--schedule") {
+      if (value == "fifo") {
+        options.schedule = qgraph::Evaluator::FIFO;
+      } else if (value == "critical") {
+        options.schedule = qgraph::Evaluator::CRITICAL_PATH;
+      } else {
+        throw std::invalid_argument("Invalid value for --schedule <" +
+                                    std::string(value) + ">");
+      }
+    } else if (arg == "--iterations") {
+      options.iterations = parse_number<size_t>(value, "iterations");
+    } else if (arg == "--batch") {
+      options.batch = parse_number<size_t>(value, "batch size");
+    } else if (arg == "--top") {
+      options.top = parse_number<size_t>(value, "number of nodes");
+    } else {
+      throw std::invalid_argument("Unknown option " + std::string(arg) + " " +
+                                  std::string(value));
+    }
+  }
+
+  if (options.file.has_value() == options.shape.has_value()) {
+    throw std::invalid_argument("Expected either a file or --generate");
+  }
+  if (options.mode != "serial" && options.mode != "parallel" &&
+      options.mode != "partitioned") {
+    throw std::invalid_argument("Unknown mode <" + options.mode + ">");
+  }
+  if (options.threads == 0 || options.iterations == 0 || options.batch == 0) {
+    throw std::invalid_argument(
+        "Threads, iterations and batch must be positive");
+  }
+
+  return options;
+};
+
+// Value below which `fraction` of `samples` fall. Sorts `samples`.
+static double percentile(std::vector<double> &samples, double fraction) {
+  std::sort(samples.begin(), samples.end());
+  auto index = static_cast<size_t>(fraction * (samples.size() - 1));
+  return samples[index];
+};
+
+// Largest resident set of this process so far, in bytes.
+static size_t peak_rss() {
+  rusage resources{};
+  getrusage(RUSAGE_SELF, &resources);
+  // Kilobytes on Linux.
+  return static_cast<size_t>(resources.ru_maxrss) * 1024;
+};
+
+// `node_cost` returns the smoothed execute time of a node, or a
+// negative value if it has not run.
+static void
+report_hot_spots(const std::function<double(qgraph::NodeId)> &node_cost,
+                 const GraphSpec &spec, size_t top) {
+  std::vector<std::pair<double, qgraph::NodeId>> costs;
+  double total = 0.0;
+  for (size_t id = 0; id < spec.nodes.size(); ++id) {
+    if (auto cost = node_cost(id); cost >= 0) {
+      costs.push_back({cost, static_cast<qgraph::NodeId>(id)});
+      total += cost;
+    }
+  }
+
+  top = std::min(top, costs.size());
+  std::partial_sort(costs.begin(), costs.begin() + top, costs.end(),
+                    std::greater<>());
+
+  std::printf("hot spots   (smoothed execute time)\n");
+  for (size_t i = 0; i < top; ++i) {
+    auto [cost, id] = costs[i];
+    const auto &node = spec.nodes[id];
+    std::printf("  node %-6u %-8s %-8s %12.3f us %6.2f%%\n",
+                static_cast<unsigned>(id),
+                node.kind.c_str(), node.argument.c_str(), cost / 1000.0,
+                total > 0 ? 100.0 * cost / total : 0.0);
+  }
+};
+
+static int run(const Options &options) {
+  auto spec = options.file ? read_graph(*options.file)
+                           : generate_graph(*options.shape, options.nodes,
+                                            options.work, options.seed);
+  if (options.write) {
+    write_graph(spec, *options.write);
+  }
+
+  if (spec.nodes.empty()) {
+    throw std::runtime_error("The graph has no nodes");
+  }
+
   qgraph::Graph g;
+  build_graph(spec, g);
+
+  std::printf("graph       %s, %zu nodes, %zu links\n", spec.name.c_str(),
+              spec.nodes.size(), spec.links.size());
+  if (options.mode == "serial") {
+    std::printf("mode        serial\n");
+  } else if (options.mode == "parallel") {
+    std::printf("mode        parallel, %zu threads, %s schedule\n",
+                options.threads,
+                options.schedule == qgraph::Evaluator::FIFO ? "fifo"
+                                                            : "critical path");
+  } else {
+    std::printf("mode        partitioned, %zu worker processes\n",
+                options.threads);
+  }
+
+  // Workers are forked before this process starts any thread.
+  std::optional<qgraph::PartitionedEvaluator> partitioned;
+  if (options.mode == "partitioned") {
+    partitioned.emplace(g, options.threads);
+  }
   qgraph::Evaluator eval(g);
 
-  g.add_node<ConstantNode>(100);
-  g.add_node<ConstantNode>(100);
-  g.add_node<MathNode>();
-  g.add_node<MathNode>(MathNode::Operation::MUL);
+  auto evaluate = [&] {
+    if (partitioned) {
+      partitioned->evaluate();
+      return;
+    }
+    auto status = options.mode == "serial"
+                      ? eval.evaluate()
+                      : eval.evaluate_parallel(options.threads,
+                                               options.schedule);
+    if (!status.finished()) {
+      throw std::runtime_error("Evaluation did not complete");
+    }
+  };
 
-  // Connecting the nodes.
-  g.connect<int>(0, ConstantNode::Output, 2, MathNode::LHS);
-  g.connect<int>(1, ConstantNode::Output, 2, MathNode::RHS);
-  g.connect<int>(2, MathNode::RESULT, 3, MathNode::LHS);
-  g.connect<int>(0, ConstantNode::Output, 3, MathNode::RHS);
+  // Warm up.
+  evaluate();
 
-  // Evaluating the graph.
-  eval.evaluate();
+  std::vector<double> samples;
+  samples.reserve(options.iterations);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < options.iterations; ++i) {
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t j = 0; j < options.batch; ++j) {
+      evaluate();
+    }
+    auto end = std::chrono::steady_clock::now();
+    samples.push_back(std::chrono::duration<double, std::micro>(end - begin)
+                          .count() /
+                      static_cast<double>(options.batch));
+  }
+  auto elapsed = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
 
-  // Getting the result.
-  auto res = g.current_output_value<int>(3, MathNode::RESULT);
+  auto evaluations = static_cast<double>(options.iterations * options.batch);
+  std::printf("samples     %zu x %zu evaluations\n", options.iterations,
+              options.batch);
+  // Evaluations of a batch are timed together, which hides how they
+  // vary within it.
+  std::printf("latency     p50 %.1f us, p99 %.1f us per evaluation%s\n",
+              percentile(samples, 0.50), percentile(samples, 0.99),
+              options.batch > 1 ? ", of batch means" : "");
+  std::printf("throughput  %.1f evaluations/s, %.3g nodes/s\n",
+              evaluations / elapsed,
+              evaluations * static_cast<double>(spec.nodes.size()) / elapsed);
+  auto mib = [](size_t bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+  };
+  if (partitioned) {
+    // Workers are reaped only when the evaluator is destroyed, so they
+    // report their own peak. Pages shared since the fork count twice.
+    size_t workers = 0;
+    size_t largest = 0;
+    for (qgraph::PartitionId part = 0; part < partitioned->num_parts();
+         ++part) {
+      workers += partitioned->peak_memory(part);
+      largest = std::max(largest, partitioned->peak_memory(part));
+    }
+    std::printf("peak rss    %.1f MiB total, %.1f MiB parent, "
+                "%.1f MiB largest worker\n",
+                mib(peak_rss() + workers), mib(peak_rss()), mib(largest));
+  } else {
+    std::printf("peak rss    %.1f MiB\n", mib(peak_rss()));
+  }
+  std::printf("result      node %zu = %d\n", spec.nodes.size() - 1,
+              g.current_output_value<int>(spec.nodes.size() - 1, 0));
 
-  std::cout << "(100 + 100) * 100 = " << res << "\n";
+  if (partitioned) {
+    report_hot_spots(
+        [&](qgraph::NodeId id) { return partitioned->node_cost(id); }, spec,
+        options.top);
+  } else {
+    report_hot_spots([&](qgraph::NodeId id) { return eval.node_cost(id); },
+                     spec, options.top);
+  }
 
   return 0;
 };
+
+int main(int argc, char **argv) {
+  Options options;
+  try {
+    options = parse_options(argc, argv);
+  } catch (const std::invalid_argument &error) {
+    std::cerr << "qgraph: " << error.what() << "\n" << usage;
+    return 1;
+  }
+
+  try {
+    return run(options);
+  } catch (const std::exception &error) {
+    std::cerr << "qgraph: " << error.what() << "\n";
+    return 1;
+  }
+};